@@ -0,0 +1,79 @@
+/*
+ * arena: bump allocation of scratch memory that dies with one request
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- arena_alloc(), arena_trim() and arena_reset() over kalloc_pages()
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+/*
+ * An arena is a chain of chunks of 2^ARENAORDER pages. Allocating
+ * bumps an offset into the newest chunk and starts a new one when
+ * it runs out; nothing is freed on its own, arena_reset() gives
+ * every chunk back at once. Each process has one, p->arena, for
+ * a system call that needs memory only until it returns; the
+ * owner is the only user, so there is no lock.
+ */
+
+#define ARENASIZE (PGSIZE << ARENAORDER)
+
+struct achunk {
+  struct achunk *prev;      // Chunk allocated before this one.
+  uint64 pad;               // Keeps allocations 16-byte aligned.
+};
+
+// n bytes, 16-byte aligned, at most ARENAMAX. Returns 0 if out
+// of memory.
+void*
+arena_alloc(struct arena *a, uint64 n)
+{
+  struct achunk *c;
+  void *v;
+
+  n = (n + 15) & ~15L;
+  if(n > ARENAMAX)
+    return 0;
+  if(a->cur == 0 || a->off + n > ARENASIZE){
+    if((c = kalloc_pages(ARENAORDER)) == 0)
+      return 0;
+    c->prev = a->cur;
+    a->cur = c;
+    a->off = sizeof(struct achunk);
+  }
+  v = (char*)a->cur + a->off;
+  a->last = a->off;
+  a->off += n;
+  return v;
+}
+
+// Shrink v, the latest allocation, to n bytes, for a caller that
+// learns how much it needed only after filling it.
+void
+arena_trim(struct arena *a, void *v, uint64 n)
+{
+  if(a->cur == 0 || (char*)v != (char*)a->cur + a->last)
+    panic("arena_trim");
+  a->off = a->last + ((n + 15) & ~15L);
+}
+
+// Free everything allocated from a.
+void
+arena_reset(struct arena *a)
+{
+  struct achunk *c;
+
+  while((c = a->cur) != 0){
+    a->cur = c->prev;
+    kfree_pages(c, ARENAORDER);
+  }
+  a->off = a->last = 0;
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,70 +22,297 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "virtio.h"
+#include "trace.h"
+#include "iostat.h"
+#include "proc.h"
 
-struct {
+// Buffers are hashed by (dev, blockno) into buckets, each with
+// its own lock, so lookups of different blocks rarely contend.
+// Each bucket keeps its buffers by how recently they were
+// released, most recent first. A miss recycles the unused buffer
+// released longest ago, from whichever bucket holds it.
+//
+// The cache starts with NBUF buffers and grows up to NBUFMAX,
+// from kalloc()'d slabs, while more than BUFMINFREE pages of
+// memory are free. When free memory drops below half of that,
+// misses hand grown buffers back instead.
+#define NBUCKET 61
+#define BUFMINFREE 1024
+
+struct bucket {
   struct spinlock lock;
+  struct buf *head;   // most recently released
+  struct buf *tail;   // least recently released
+};
+
+struct {
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct kmem_cache *cache;   // buffers beyond the first NBUF
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Serializes misses, so that only one process at a time moves
+  // buffers between buckets and the same block cannot be added
+  // twice. Lock order: evict_lock, then bucket locks; it is the
+  // only holder of two bucket locks at once.
+  struct spinlock evict_lock;
+  int nbuf;                   // buffers in the cache, under evict_lock
 } bcache;
 
+// Counters for iostat(), also counted by virtio_disk.c and log.c.
+struct iostat iost;
+
+// Add n to a counter updated without a common lock.
+#define IOSTAT_ADD(f, n) __sync_fetch_and_add(&iost.f, (n))
+
+static struct bucket*
+bucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bucket_remove(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  else
+    bk->tail = b->prev;
+}
+
+static void
+bucket_push(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  else
+    bk->tail = b;
+  bk->head = b;
+}
+
+static void
+binitbuf(struct buf *b)
+{
+  initsleeplock(&b->lock, "buffer");
+  b->disk = 0;
+  b->done = 0;
+  b->data = b->space;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  initticket(&bcache.evict_lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  if((bcache.cache = kmem_cache_create("buf", sizeof(struct buf), 0)) == 0)
+    panic("binit");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; they start out
+  // invalid, so any of them can be recycled for any block.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binitbuf(b);
+    bucket_push(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
+  bcache.nbuf = NBUF;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Return the buffer for block blockno of dev in bk with a
+// reference added, or 0. Caller must hold bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bucket_find(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Take the least recently released unused buffer out of its
+// bucket, or return 0 if every buffer is in use.
+// Caller must hold evict_lock.
+static struct buf*
+bevict(void)
+{
+  struct bucket *bk, *best = 0;
+  struct buf *b, *victim = 0;
+
+  // The lock of the bucket holding the best buffer so far stays
+  // held, so that no one can take a reference to it meanwhile.
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    for(b = bk->tail; b && b->refcnt != 0; b = b->prev)
+      ;
+    if(b && (victim == 0 || b->lastuse < victim->lastuse)){
+      if(best)
+        release(&best->lock);
+      best = bk;
+      victim = b;
+    } else {
+      release(&bk->lock);
+    }
+  }
+  if(victim){
+    bucket_remove(best, victim);
+    release(&best->lock);
+    if(victim->valid)
+      IOSTAT_ADD(bevict, 1);
+  }
+  return victim;
+}
+
+static int
+bgrown(struct buf *b)
+{
+  return b < bcache.buf || b >= bcache.buf+NBUF;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+// Find a buffer for a block not in the cache: a new one while
+// memory is plentiful, else a recycled one, allocating anyway
+// if all are in use.
+// Caller must hold evict_lock.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+  int nfree = kfreepages();
+
+  // give an old buffer back when memory runs low.
+  if(nfree < BUFMINFREE / 2 && bcache.nbuf > NBUF &&
+     (b = bevict()) != 0){
+    if(bgrown(b)){
+      kmem_cache_free(bcache.cache, b);
+      bcache.nbuf--;
+    } else {
+      // a static buffer; take it instead.
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  if(bcache.nbuf < NBUFMAX && nfree > BUFMINFREE &&
+     (b = kmem_cache_alloc(bcache.cache)) != 0){
+    binitbuf(b);
+    bcache.nbuf++;
+    return b;
+  }
+  if((b = bevict()) != 0)
+    return b;
+  if(bcache.nbuf < NBUFMAX && (b = kmem_cache_alloc(bcache.cache)) != 0){
+    binitbuf(b);
+    bcache.nbuf++;
+    return b;
+  }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer with a reference
+// added, but not locked.
+static struct buf*
+blookup(uint dev, uint blockno)
+{
+  struct bucket *bk = bucket(dev, blockno);
+  struct buf *b;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = bucket_find(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    IOSTAT_ADD(bhit, 1);
+    return b;
+  }
+
+  // Not cached. Look again now that no one else can add it.
+  acquire(&bcache.evict_lock);
+  acquire(&bk->lock);
+  b = bucket_find(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.evict_lock);
+    IOSTAT_ADD(bhit, 1);
+    return b;
+  }
+  IOSTAT_ADD(bmiss, 1);
+
+  if((b = bnew()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+#if MEMDISK
+  // the buffer is the image's block itself: nothing to read,
+  // and writes land in place.
+  b->data = ramdisk_block(blockno);
+  b->valid = 1;
+#endif
+  b->refcnt = 1;
+  acquire(&bk->lock);
+  bucket_push(bk, b);
+  release(&bk->lock);
+  release(&bcache.evict_lock);
+  return b;
+}
+
+// Drop a reference to b. Once no one holds one, move it to
+// the front of its bucket, stamped with the time, for
+// bevict()'s choice of buffer to recycle.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+    bucket_remove(bk, b);
+    bucket_push(bk, b);
+  }
+  release(&bk->lock);
+}
+
+// Completion callbacks for disk_submit(), called by the
+// disk interrupt, or at once by ramdisk_submit(). They unlock
+// b on behalf of the process that started the transfer.
+static void
+readdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+static void
+writedone(struct buf *b)
+{
+  releasesleep(&b->lock);
+}
+
+// Return the locked buffer for block blockno of dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b = blookup(dev, blockno);
+
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -95,24 +322,107 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
+  IOSTAT_ADD(bread, 1);
+  TRACE(b->valid ? TR_BHIT : TR_BMISS, dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    disk_rw(b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Start reading block blockno of dev into the cache, for a
+// bread() soon after, without waiting for the disk. Does
+// nothing if the block is cached or its buffer is busy.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b = blookup(dev, blockno);
+
+  if(b->valid || !tryacquiresleep(&b->lock)){
+    bput(b);
+    return;
+  }
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  // readdone() releases b once the data is in.
+  IOSTAT_ADD(readahead, 1);
+  b->done = readdone;
+  disk_submit(&b, 1, 0);
+}
+
+// Start writing b's contents to disk, without waiting. b must be
+// locked, and stays locked until the write is done; the caller
+// gives it up with bwait(), after starting more writes.
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  IOSTAT_ADD(bwrite, 1);
+  b->done = writedone;
+  disk_submit(&b, 1, 1);
+}
+
+// Wait for the write of b started by bwrite_start() to finish,
+// and release b.
+void
+bwait(struct buf *b)
+{
+  acquiresleep(&b->lock);
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  IOSTAT_ADD(bwrite, 1);
+  disk_rw(b, 1);
+}
+
+// Write the contents of the n locked buffers in bs to disk,
+// like bwrite() on each, but with the writes of each run of
+// consecutive blocks gathered into one disk request, and all
+// requests in flight at once. Sorts bs by block number.
+void
+bwrite_many(struct buf **bs, int n)
+{
+  struct buf *b;
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwrite_many");
+    IOSTAT_ADD(bwrite, 1);
+    // insertion sort; callers pass a log's worth at most.
+    for(j = i; j > 0 && bs[j-1]->blockno > bs[j]->blockno; j--){
+      b = bs[j];
+      bs[j] = bs[j-1];
+      bs[j-1] = b;
+    }
+  }
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < VIRTIO_MAXSEG &&
+          bs[j]->dev == bs[i]->dev &&
+          bs[j]->blockno == bs[j-1]->blockno + 1; j++)
+      ;
+    for(int k = i; k < j; k++)
+      bs[k]->done = writedone;
+    disk_submit(bs + i, j - i, 1);
+  }
+
+  // the buffers stay the caller's once written.
+  for(i = 0; i < n; i++)
+    acquiresleep(&bs[i]->lock);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +430,33 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Copy the I/O counters to the user struct iostat at addr.
+int
+iostat(uint64 addr)
+{
+  struct iostat st = iost;
 
+  st.nbuf = *(volatile int*)&bcache.nbuf;
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
+}
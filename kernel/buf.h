@@ -1,12 +1,16 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  void (*done)(struct buf*); // called when virtio_disk_submit() is done
+  struct buf *qnext; // next buf in the same disk request
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when refcnt last dropped to 0
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // the block: space, or with MEMDISK the image's copy
+  uchar space[BSIZE];
 };
 
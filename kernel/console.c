@@ -35,9 +35,9 @@ consputc(int c)
 {
   if(c == BACKSPACE){
     // if the user typed backspace, overwrite with a space.
-    uartputc_sync('\b'); uartputc_sync(' '); uartputc_sync('\b');
+    uartputc_async('\b'); uartputc_async(' '); uartputc_async('\b');
   } else {
-    uartputc_sync(c);
+    uartputc_async(c);
   }
 }
 
@@ -58,13 +58,17 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[128];
+  int i, m, w;
+
+  // a chunk at a time, since the copy may fault and so cannot
+  // be made holding the uart's lock.
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    if((w = uartwrite(buf, m)) < m)
+      return i + w;
   }
 
   return i;
@@ -1,13 +1,24 @@
 /*
  * dynamic memory allocation
- * update time: 2024-4-9
+ * update time: 2026-10-14
  * author: feng
- * version: 1.3
+ * version: 2.0
  * update log:
  * v1.0 -- structs, init(), alloc() and free()
  * v1.1 -- coalesce_blocks(), for reclaiming fragment
  * v1.2 -- alignment, size is the size of dheader(16)
  * v1.3 -- check if the free address is valid
+ * v1.4 -- segregated size-class free lists, dalloc() no longer walks the heap
+ * v1.5 -- prev-physical pointer and magic in dheader, dfree() coalesces in O(1)
+ * v1.6 -- per-CPU magazines of small blocks in front of the shared heap
+ * v1.7 -- dheapinfo(), free and largest free bytes for memtest's benchmarks
+ * v1.8 -- dstat(): usage and fragmentation counters kept up to date as
+ *         blocks move, so reading them takes no walk of the heap
+ * v1.9 -- drealloc(), growing in place into a free successor, and
+ *         dalloc_aligned()
+ * v2.0 -- the heap is a list of chunks from kalloc_pages(), added as it
+ *         fills up and given back once empty, instead of a fixed
+ *         HEAP_SIZE carved out below PHYSTOP
  */
 
 #include "types.h"
@@ -16,164 +27,711 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "proc.h"
+#include "lockstat.h"
+#include "dstat.h"
+#include "trace.h"
 
 #define ALIGNMENT_SIZE 16 // 16B alignment
 
 /*
  * Structure representing a header for a memory block in the dynamic memory heap.
- * Each block contains its information and a pointer to the next block.
+ * Each block contains its information and a pointer to the physically
+ * preceding block; the following block starts right after the data.
  */
 struct dheader {
   unsigned data_size;       // Size of the memory block (excluding header).
-  unsigned used;            // Flag indicating whether the memory block is used or free.
-  struct dheader *next;     // Pointer to the next memory block.
+  unsigned magic;           // DMAGIC_USED or DMAGIC_FREE.
+  struct dheader *prev;     // Pointer to the previous memory block.
 };
 
 #define HEADER_SIZE 16 // size of dheader
 
+// Header magic values. dfree() only trusts a header carrying
+// DMAGIC_USED, which catches wild and double frees without a walk.
+#define DMAGIC_USED 0xda110c8d
+#define DMAGIC_FREE 0xdf4eeb1c
+#define DMAGIC_CACHED 0xdcac4ed0 // Freed, but parked in a magazine.
+#define DMAGIC_FENCE 0xdfe4ce00  // Header-sized end marker of a chunk.
+
+/*
+ * The heap is a list of chunks, each 2^order pages from
+ * kalloc_pages(): this header, then blocks, then a fence that
+ * next_block() stops at. Blocks never span chunks. The heap
+ * grows by a chunk of DCHUNKORDER, or a bigger one for a bigger
+ * block, when nothing fits, and a chunk that becomes entirely
+ * free goes back to kalloc() unless it is the only empty one.
+ */
+struct dchunk {
+  struct dchunk *next;      // Next chunk of the heap.
+  uint order;               // Size is PGSIZE << order.
+  uint pad;                 // Keeps blocks 16-byte aligned.
+};
+
+// A chunk's own header, first block header and fence.
+#define CHUNK_OVERHEAD (sizeof(struct dchunk) + 2 * HEADER_SIZE)
+
+/*
+ * Free blocks keep their size-class list links in the first bytes
+ * of their (otherwise unused) data area, so every block must have
+ * room for one of these.
+ */
+struct dlink {
+  struct dheader *prev;     // Previous free block in the same size class.
+  struct dheader *next;     // Next free block in the same size class.
+};
+
+#define MIN_DATA_SIZE 16 // sizeof(struct dlink)
+
+/*
+ * Size classes are powers of two starting at MIN_DATA_SIZE.
+ * Bin i holds the free blocks whose data_size lies in
+ * [MIN_DATA_SIZE << i, MIN_DATA_SIZE << (i+1)), so the last bin
+ * covers blocks up to the whole heap.
+ */
+#define NBINS DSTAT_NBINS // 16B << 20 == 16MB > DALLOCMAX
+
 /*
  * Structure representing the dynamic memory heap.
- * Contains a spinlock for synchronization and a pointer to the first memory block.
+ * Contains a spinlock for synchronization and the list of chunks.
  */
 struct {
   struct spinlock lock;     // Spinlock for synchronization.
-  struct dheader *start;    // Pointer to the first memory block.
+  struct dchunk *chunks;    // Chunks the heap is made of.
+  uint64 heapsize;          // Bytes in chunks.
+  int nempty;               // Chunks that are one free block.
+  struct dheader *bins[NBINS]; // Heads of the size-class free lists.
+  uint binmap;              // Bit i set iff bins[i] is non-empty.
+
+  // Counters for dstat(), kept by bin_insert() and bin_remove(),
+  // and by dalloc() and dfree() for blocks not in magazines.
+  uint64 freebytes;         // Total data_size of the free blocks.
+  uint64 nfreeblocks;
+  uint64 nbin[NBINS];       // Free blocks in each bin.
+  uint64 inuse;
+  uint64 nalloc;
+  uint64 nfree;
 } dmem;
 
+/*
+ * Per-CPU magazines: small LIFO caches of recently freed blocks,
+ * one for each small data size. Blocks in a magazine stay carved
+ * out of the heap (DMAGIC_CACHED), so a hart that allocates and
+ * frees the same sizes only takes its own, uncontended lock.
+ */
+#define MAG_CLASSES 16  // Cached data sizes: 16B..256B, 16B apart.
+#define MAG_MAX (MAG_CLASSES * ALIGNMENT_SIZE)
+#define MAG_SIZE 16     // Blocks per magazine.
+#define MAG_BATCH 8     // Blocks moved per refill or flush.
+
+struct dmagazine {
+  int n;                              // Number of cached blocks.
+  struct dheader *blocks[MAG_SIZE];   // Most recently freed on top.
+};
+
+struct {
+  struct spinlock lock;     // Only contended while draining.
+  struct dmagazine mags[MAG_CLASSES];
+  // dstat() counters of the blocks this hart's magazines hand out.
+  uint64 inuse;
+  uint64 nalloc;
+  uint64 nfree;
+} dcpus[NCPU];
+
+#define LINK(b) ((struct dlink*)((b) + 1))
+
+// The block physically following b, or 0 if b is the last one
+// of its chunk.
+static struct dheader*
+next_block(struct dheader *b)
+{
+  struct dheader *n = (struct dheader*)((char*)(b + 1) + b->data_size);
+  return n->magic != DMAGIC_FENCE ? n : 0;
+}
+
+// Size class of a free block holding data_size bytes:
+// floor(log2(data_size / MIN_DATA_SIZE)).
+static int
+size_class(unsigned data_size)
+{
+  int c = 0;
+
+  data_size /= MIN_DATA_SIZE;
+  while (data_size > 1 && c < NBINS - 1) {
+    data_size >>= 1;
+    c++;
+  }
+  return c;
+}
+
+// Insert a free block at the head of its size-class list.
+// dmem.lock must be held.
+static void
+bin_insert(struct dheader *b)
+{
+  int c = size_class(b->data_size);
+
+  LINK(b)->prev = 0;
+  LINK(b)->next = dmem.bins[c];
+  if (dmem.bins[c])
+    LINK(dmem.bins[c])->prev = b;
+  dmem.bins[c] = b;
+  dmem.binmap |= 1 << c;
+  dmem.freebytes += b->data_size;
+  dmem.nfreeblocks++;
+  dmem.nbin[c]++;
+}
+
+// Unlink a free block from its size-class list.
+// dmem.lock must be held.
+static void
+bin_remove(struct dheader *b)
+{
+  int c = size_class(b->data_size);
+
+  if (LINK(b)->prev)
+    LINK(LINK(b)->prev)->next = LINK(b)->next;
+  else
+    dmem.bins[c] = LINK(b)->next;
+  if (LINK(b)->next)
+    LINK(LINK(b)->next)->prev = LINK(b)->prev;
+  if (dmem.bins[c] == 0)
+    dmem.binmap &= ~(1 << c);
+  dmem.freebytes -= b->data_size;
+  dmem.nfreeblocks--;
+  dmem.nbin[c]--;
+}
+
+// Find a free block with at least data_size bytes and take it
+// off its list, or return 0. Any block in a class above the
+// request's own class is big enough, so the first non-empty
+// such bin is used; only the request's own class needs a scan.
+// dmem.lock must be held.
+static struct dheader*
+bin_take(unsigned data_size)
+{
+  struct dheader *b;
+  int c = size_class(data_size);
+  uint mask;
+
+  // Larger classes are guaranteed to fit.
+  mask = dmem.binmap & ~((2 << c) - 1);
+  if (mask) {
+    while ((mask & (1 << c)) == 0)
+      c++;
+    b = dmem.bins[c];
+    bin_remove(b);
+    return b;
+  }
+
+  // Blocks in the same class may still be too small.
+  for (b = dmem.bins[c]; b != 0; b = LINK(b)->next) {
+    if (b->data_size >= data_size) {
+      bin_remove(b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+static void free_block(struct dheader *curr);
+
+// Add a chunk big enough for a block of data_size bytes to the
+// heap, as one free block. Returns 0, or -1 if out of memory.
+// dmem.lock must be held.
+static int
+heap_grow(unsigned data_size)
+{
+  int order = DCHUNKORDER;
+
+  while (((uint64)PGSIZE << order) - CHUNK_OVERHEAD < data_size)
+    if (++order >= MAXORDER)
+      return -1;
+
+  struct dchunk *c = kalloc_pages(order);
+  if (c == 0)
+    return -1;
+  c->order = order;
+  c->next = dmem.chunks;
+  dmem.chunks = c;
+  dmem.heapsize += (uint64)PGSIZE << order;
+
+  struct dheader *fence = (struct dheader*)((char*)c + ((uint64)PGSIZE << order)) - 1;
+  fence->data_size = 0;
+  fence->magic = DMAGIC_FENCE;
+  fence->prev = 0;
+
+  struct dheader *b = (struct dheader*)(c + 1);
+  b->data_size = (char*)fence - (char*)(b + 1);
+  b->magic = DMAGIC_FREE;
+  b->prev = 0;
+  bin_insert(b);
+  dmem.nempty++;
+  return 0;
+}
+
+// Give the chunk that free block b fills entirely back to kalloc().
+// dmem.lock must be held.
+static void
+heap_shrink(struct dheader *b)
+{
+  struct dchunk *c = (struct dchunk*)b - 1;
+  struct dchunk **cp;
+
+  for (cp = &dmem.chunks; *cp != c; cp = &(*cp)->next)
+    ;
+  *cp = c->next;
+  dmem.heapsize -= (uint64)PGSIZE << c->order;
+  kfree_pages(c, c->order);
+}
+
+// Cut block curr, which is off the free lists, down to data_size
+// bytes if the rest is big enough to be a block of its own, and
+// free the rest.
+// dmem.lock must be held.
+static void
+split_block(struct dheader *curr, unsigned data_size)
+{
+  if (curr->data_size - data_size >= HEADER_SIZE + MIN_DATA_SIZE) {
+    struct dheader *new_block = (struct dheader*)((char*)(curr + 1) + data_size);
+    new_block->data_size = curr->data_size - data_size - HEADER_SIZE;
+    new_block->magic = DMAGIC_USED;
+    new_block->prev = curr;
+    curr->data_size = data_size;
+
+    struct dheader *after = next_block(new_block);
+    if (after)
+      after->prev = new_block;
+    free_block(new_block);
+  }
+}
+
+// Take a block with at least data_size bytes off the free lists,
+// splitting off the tail if it is big enough to be a block of its
+// own, and mark it used. Returns 0 if nothing fits.
+// dmem.lock must be held.
+static struct dheader*
+take_block(unsigned data_size)
+{
+  struct dheader *curr = bin_take(data_size);
+  if (curr == 0 && heap_grow(data_size) == 0)
+    curr = bin_take(data_size);
+  if (curr == 0)
+    return 0;
+  if (curr->prev == 0 && next_block(curr) == 0)
+    dmem.nempty--; // its chunk is no longer empty.
+
+  curr->magic = DMAGIC_USED;
+  split_block(curr, data_size);
+  return curr;
+}
+
+// Return a block to the free lists, merging it with free
+// physical neighbours.
+// dmem.lock must be held.
+static void
+free_block(struct dheader *curr)
+{
+  struct dheader *next = next_block(curr);
+
+  curr->magic = DMAGIC_FREE;
+
+  // Coalesce with the following block.
+  if (next != 0 && next->magic == DMAGIC_FREE) {
+    bin_remove(next);
+    curr->data_size += next->data_size + HEADER_SIZE;
+  }
+
+  // Coalesce with the preceding block.
+  if (curr->prev != 0 && curr->prev->magic == DMAGIC_FREE) {
+    bin_remove(curr->prev);
+    curr->prev->data_size += curr->data_size + HEADER_SIZE;
+    curr = curr->prev;
+  }
+
+  if ((next = next_block(curr)) != 0)
+    next->prev = curr;
+
+  // Keep one empty chunk around, so that a heap hovering at a
+  // chunk boundary does not keep growing and shrinking.
+  if (curr->prev == 0 && next == 0) {
+    if (dmem.nempty > 0) {
+      heap_shrink(curr);
+      return;
+    }
+    dmem.nempty++;
+  }
+  bin_insert(curr);
+}
+
+// The calling hart's magazine for blocks of data_size bytes,
+// returned with that hart's magazine lock held.
+static struct dmagazine*
+mag_get(unsigned data_size, int *id)
+{
+  push_off();
+  *id = cpuid();
+  pop_off();
+  acquire(&dcpus[*id].lock);
+  return &dcpus[*id].mags[data_size / ALIGNMENT_SIZE - 1];
+}
+
+// Move every cached block of every hart back to the heap,
+// so that a failing allocation can use them.
+static void
+mag_drain(void)
+{
+  for (int id = 0; id < NCPU; id++) {
+    acquire(&dcpus[id].lock);
+    acquire(&dmem.lock);
+    for (int c = 0; c < MAG_CLASSES; c++) {
+      struct dmagazine *m = &dcpus[id].mags[c];
+      while (m->n > 0)
+        free_block(m->blocks[--m->n]);
+    }
+    release(&dmem.lock);
+    release(&dcpus[id].lock);
+  }
+}
+
 /*
  * Initializes the dynamic memory heap.
- * Sets up the spinlock and initializes the heap with a single block of size HEAP_SIZE.
+ * Sets up the spinlock; the heap starts out without chunks, and gets
+ * its first on the first dalloc(). Called again by memtest, which
+ * resets the heap: any chunks from before go back to kalloc().
  */
 void
 dinit()
 {
-  initlock(&dmem.lock, "dmem");
-  
-  // Allocate memory for the first block.
-  dmem.start = (struct dheader*)(PHYSTOP - HEAP_SIZE);
-  
-  // Initialize the first block.
-  dmem.start->data_size = HEAP_SIZE - HEADER_SIZE;
-  dmem.start->used = 0; // Initially, the block is not used.
-  dmem.start->next = 0; // No next block initially.
+  struct dchunk *c;
+
+  initticket(&dmem.lock, "dmem");
+
+  while ((c = dmem.chunks) != 0) {
+    dmem.chunks = c->next;
+    kfree_pages(c, c->order);
+  }
+  dmem.heapsize = 0;
+  dmem.nempty = 0;
+
+  memset(dmem.bins, 0, sizeof(dmem.bins));
+  dmem.binmap = 0;
+  dmem.freebytes = dmem.nfreeblocks = 0;
+  memset(dmem.nbin, 0, sizeof(dmem.nbin));
+  dmem.inuse = dmem.nalloc = dmem.nfree = 0;
+
+  // All magazines start out empty.
+  for (int id = 0; id < NCPU; id++) {
+    initlock(&dcpus[id].lock, "dmag");
+    memset(dcpus[id].mags, 0, sizeof(dcpus[id].mags));
+    dcpus[id].inuse = dcpus[id].nalloc = dcpus[id].nfree = 0;
+  }
 }
 
 /*
  * dalloc function allocates a memory block of specified size from the dynamic memory heap.
- * If a suitable block is found in the heap, it is allocated and returned to the caller.
+ * Small blocks come from this hart's magazine, which is refilled from the heap
+ * in batches; other blocks are taken from the segregated free lists.
  * If no suitable block is found, returns NULL.
  */
 void *
 dalloc(unsigned size)
 {
-  // Calculate the total size required, including the size of the header.
-  unsigned required_size = size + HEADER_SIZE;
-  
-  // Round up the required size to the nearest multiple of ALIGNMENT_SIZE.
-  required_size = (required_size + (ALIGNMENT_SIZE - 1)) & ~(ALIGNMENT_SIZE - 1);
-  
-  // Initialize pointer to traverse the heap.
-  acquire(&dmem.lock);
-  struct dheader *curr = dmem.start;
-
-  // Traverse the heap to find a suitable block.
-  while (curr != 0) {
-    // Check if the current block is large enough to accommodate the requested size.
-    if (!curr->used && curr->data_size >= required_size) {
-      // Check if the current block can be split into two blocks.
-      if (curr->data_size > required_size) {
-        // Create a new block after the allocated block.
-        struct dheader *new_block = (struct dheader*)((char*)curr + required_size);
-        new_block->data_size = curr->data_size - required_size;
-        new_block->next = curr->next;
-        new_block->used = 0; // The new block is initially unused.
-        
-        // Update the size of the allocated block and adjust the next pointer.
-        curr->data_size = (size + (ALIGNMENT_SIZE - 1)) & ~(ALIGNMENT_SIZE - 1);
-        curr->next = new_block;
+  struct dheader *curr = 0;
+  int id;
+
+  if (size > DALLOCMAX)
+    return 0;
+
+  // Round up the data size to the nearest multiple of ALIGNMENT_SIZE.
+  unsigned data_size = (size + (ALIGNMENT_SIZE - 1)) & ~(ALIGNMENT_SIZE - 1);
+  if (data_size < MIN_DATA_SIZE)
+    data_size = MIN_DATA_SIZE;
+
+  if (data_size <= MAG_MAX) {
+    struct dmagazine *m = mag_get(data_size, &id);
+    if (m->n == 0) {
+      // Refill half the magazine at once.
+      acquire(&dmem.lock);
+      while (m->n < MAG_BATCH && (curr = take_block(data_size)) != 0) {
+        curr->magic = DMAGIC_CACHED;
+        m->blocks[m->n++] = curr;
       }
-      
-      // Mark the current block as used.
-      curr->used = 1;
-      
-      // Release the lock before returning the allocated block.
       release(&dmem.lock);
-      
-      // Return a pointer to the allocated memory block, skipping the header.
-      return (void*)(curr + 1);
     }
-    
-    // Move to the next block in the heap.
-    curr = curr->next;
+    curr = 0;
+    if (m->n > 0) {
+      curr = m->blocks[--m->n];
+      curr->magic = DMAGIC_USED;
+      dcpus[id].inuse += curr->data_size;
+      dcpus[id].nalloc++;
+    }
+    release(&dcpus[id].lock);
+  } else {
+    acquire(&dmem.lock);
+    if ((curr = take_block(data_size)) != 0) {
+      dmem.inuse += curr->data_size;
+      dmem.nalloc++;
+    }
+    release(&dmem.lock);
   }
-  
-  release(&dmem.lock);
-  return 0;
-}
 
-/*
- * Coalesce adjacent free blocks in the dynamic memory heap.
- * This function merges contiguous free blocks into a single larger free block.
- */
-void
-coalesce_blocks()
-{
-  // Start from the beginning of the heap.
-  struct dheader *curr = dmem.start;
-  
-  // Traverse the heap to coalesce adjacent free blocks.
-  while (curr != 0 && curr->next != 0) {
-    // If the current block and its next block are both free, merge them.
-    if (!curr->used && !curr->next->used) {
-      // Merge the next block into the current block.
-      curr->data_size += curr->next->data_size + HEADER_SIZE;
-      curr->next = curr->next->next;
-    } else {
-      // Move to the next block.
-      curr = curr->next;
+  if (curr == 0) {
+    // Blocks may be cached in magazines; give them back and retry.
+    mag_drain();
+    acquire(&dmem.lock);
+    if ((curr = take_block(data_size)) != 0) {
+      dmem.inuse += curr->data_size;
+      dmem.nalloc++;
     }
+    release(&dmem.lock);
+    if (curr == 0)
+      return 0;
   }
+
+  TRACE(TR_DALLOC, size, curr + 1);
+  // Return a pointer to the allocated memory block, skipping the header.
+  return (void*)(curr + 1);
+}
+
+// The header of the allocated block at data address addr, or 0
+// if addr is not one.
+static struct dheader*
+used_block(void *addr)
+{
+  // Calculate the header address corresponding to the given data address.
+  struct dheader *curr = (struct dheader*)addr - 1;
+
+  // Check if the address is properly aligned.
+  if (((uint64)curr) % ALIGNMENT_SIZE != 0)
+    return 0;
+
+  // Check that the header lies in RAM and belongs to an allocated
+  // block whose successor points back at it. Neither field can
+  // change while the block is allocated.
+  struct dheader *next;
+  if ((uint64)curr < KERNBASE || (uint64)(curr + 1) >= PHYSTOP ||
+      curr->magic != DMAGIC_USED ||
+      (uint64)(curr + 1) + curr->data_size >= PHYSTOP ||
+      ((next = next_block(curr)) != 0 && next->prev != curr))
+    return 0;
+  return curr;
 }
 
 /*
  * dfree function deallocates a memory block previously allocated by dalloc.
- * It marks the specified memory block as free for reuse.
+ * Small blocks are parked in this hart's magazine, which is flushed to the
+ * heap in batches; other blocks are merged with free physical neighbours
+ * and put back on their free list.
  */
 void
 dfree(void *addr)
 {
-  // Calculate the header address corresponding to the given data address.
-  struct dheader *block_header = (struct dheader*)addr - 1;
+  int id;
+  struct dheader *curr;
 
-  // Check if the address is properly aligned.
-  if (((uint64)block_header) % ALIGNMENT_SIZE != 0) {
-    panic("dfree: Address is not properly aligned.");
+  if ((curr = used_block(addr)) == 0)
+    panic("dfree: Invalid address.");
+
+  if (curr->data_size <= MAG_MAX) {
+    struct dmagazine *m = mag_get(curr->data_size, &id);
+    if (m->n == MAG_SIZE) {
+      // Flush the oldest half, keeping the cache-warm blocks.
+      acquire(&dmem.lock);
+      for (int i = 0; i < MAG_BATCH; i++)
+        free_block(m->blocks[i]);
+      release(&dmem.lock);
+      memmove(m->blocks, m->blocks + MAG_BATCH,
+              (MAG_SIZE - MAG_BATCH) * sizeof(m->blocks[0]));
+      m->n -= MAG_BATCH;
+    }
+    curr->magic = DMAGIC_CACHED;
+    m->blocks[m->n++] = curr;
+    // the hart that allocated the block may have been another,
+    // so the per-hart inuse counts only add up in total.
+    dcpus[id].inuse -= curr->data_size;
+    dcpus[id].nfree++;
+    release(&dcpus[id].lock);
+    return;
   }
 
-  // Initialize pointer to traverse the heap.
   acquire(&dmem.lock);
-  struct dheader *curr = dmem.start;
+  dmem.inuse -= curr->data_size;
+  dmem.nfree++;
+  free_block(curr);
+  release(&dmem.lock);
+}
 
-  // Traverse the heap to find the header with the given address.
-  while (curr != 0) {
-    // Check if the current header's address matches the given block header's address.
-    if (curr == block_header) {
-      // Mark the block as unused.
-      curr->used = 0;
+/*
+ * drealloc resizes the block at addr to size bytes and returns its
+ * new address. The block grows in place when its physical successor
+ * is free and big enough, and shrinks in place, giving back the
+ * tail; otherwise it moves, and the old block is freed. With addr 0
+ * it is dalloc(); with size 0, dfree(). Returns 0, leaving the old
+ * block alone, if the memory cannot be allocated.
+ */
+void *
+drealloc(void *addr, unsigned size)
+{
+  if (addr == 0)
+    return dalloc(size);
+  if (size == 0) {
+    dfree(addr);
+    return 0;
+  }
+  if (size > DALLOCMAX)
+    return 0;
 
-      // Coalesce adjacent free blocks if possible.
-      coalesce_blocks();
+  struct dheader *curr;
+  if ((curr = used_block(addr)) == 0)
+    panic("drealloc: Invalid address.");
+  unsigned data_size = (size + (ALIGNMENT_SIZE - 1)) & ~(ALIGNMENT_SIZE - 1);
+  if (data_size < MIN_DATA_SIZE)
+    data_size = MIN_DATA_SIZE;
 
-      // Release the lock after deallocating the memory block.
-      release(&dmem.lock);
+  acquire(&dmem.lock);
+  unsigned old_size = curr->data_size;
+  struct dheader *next = next_block(curr);
+  if (data_size > old_size && next != 0 && next->magic == DMAGIC_FREE &&
+      old_size + HEADER_SIZE + next->data_size >= data_size) {
+    // Swallow the free successor, then give back what is left.
+    bin_remove(next);
+    curr->data_size += HEADER_SIZE + next->data_size;
+    if ((next = next_block(curr)) != 0)
+      next->prev = curr;
+  }
+  if (curr->data_size >= data_size) {
+    split_block(curr, data_size);
+    dmem.inuse += curr->data_size;
+    dmem.inuse -= old_size;
+    release(&dmem.lock);
+    return addr;
+  }
+  release(&dmem.lock);
 
-      return;
-    }
-    // Move to the next header in the heap.
-    curr = curr->next;
+  void *ptr = dalloc(size);
+  if (ptr == 0)
+    return 0;
+  memmove(ptr, addr, old_size);
+  dfree(addr);
+  return ptr;
+}
+
+/*
+ * dalloc_aligned allocates size bytes at an address that is a
+ * multiple of align, a power of two, such as PGSIZE or a cache line
+ * for per-CPU data that should not share one. The block is carved
+ * out of a larger one; the slack in front of it becomes a free
+ * block of its own, the slack behind is given back by the split.
+ * The result is freed with dfree().
+ */
+void *
+dalloc_aligned(unsigned size, unsigned align)
+{
+  if (align <= ALIGNMENT_SIZE)
+    return dalloc(size);
+  if ((align & (align - 1)) != 0 || size > DALLOCMAX || align > DALLOCMAX)
+    return 0;
+
+  unsigned data_size = (size + (ALIGNMENT_SIZE - 1)) & ~(ALIGNMENT_SIZE - 1);
+  if (data_size < MIN_DATA_SIZE)
+    data_size = MIN_DATA_SIZE;
+
+  // Room for the slack in front, which is either empty or a block
+  // of at least HEADER_SIZE + MIN_DATA_SIZE.
+  acquire(&dmem.lock);
+  struct dheader *curr = take_block(data_size + align + HEADER_SIZE + MIN_DATA_SIZE);
+  if (curr == 0) {
+    release(&dmem.lock);
+    return 0;
   }
+  uint64 start = (uint64)(curr + 1);
+  uint64 a = (start + align - 1) & ~((uint64)align - 1);
+  if (a != start && a - start < HEADER_SIZE + MIN_DATA_SIZE)
+    a += align;
 
+  if (a != start) {
+    // The front slack stays behind as curr, and is freed.
+    struct dheader *b = (struct dheader*)a - 1;
+    struct dheader *next = next_block(curr);
+    b->data_size = (char*)(curr + 1) + curr->data_size - (char*)(b + 1);
+    b->magic = DMAGIC_USED;
+    b->prev = curr;
+    curr->data_size = (char*)b - (char*)(curr + 1);
+    if (next)
+      next->prev = b;
+    free_block(curr);
+    curr = b;
+  }
+  split_block(curr, data_size);
+  dmem.inuse += curr->data_size;
+  dmem.nalloc++;
+  release(&dmem.lock);
+  return (void*)(curr + 1);
+}
+
+// Size of the largest free block. Only the highest non-empty
+// bin can hold it, so only that one is scanned.
+// dmem.lock must be held.
+static uint64
+largest_free(void)
+{
+  uint64 largest = 0;
+  int c;
+
+  if (dmem.binmap == 0)
+    return 0;
+  for (c = NBINS - 1; (dmem.binmap & (1 << c)) == 0; c--)
+    ;
+  for (struct dheader *b = dmem.bins[c]; b != 0; b = LINK(b)->next)
+    if (b->data_size > largest)
+      largest = b->data_size;
+  return largest;
+}
+
+/*
+ * dheapinfo reports the free bytes of the heap and the size of the
+ * largest free block. Blocks parked in magazines count as in use.
+ */
+void
+dheapinfo(uint64 *freebytes, uint64 *largest)
+{
+  acquire(&dmem.lock);
+  *freebytes = dmem.freebytes;
+  *largest = largest_free();
+  release(&dmem.lock);
+}
+
+/*
+ * dstat copies the heap's counters to user address addr, for the
+ * dstat() system call. The per-CPU parts are read without their
+ * locks, so the total is a snapshot only as good as a racy read.
+ * Returns 0, or -1 if addr is bad.
+ */
+int
+dstat(uint64 addr)
+{
+  struct dstat st;
+
+  memset(&st, 0, sizeof(st));
+  st.heapsize = *(volatile uint64*)&dmem.heapsize;
+  for (int id = 0; id < NCPU; id++) {
+    st.inuse += *(volatile uint64*)&dcpus[id].inuse;
+    st.nalloc += *(volatile uint64*)&dcpus[id].nalloc;
+    st.nfree += *(volatile uint64*)&dcpus[id].nfree;
+    for (int c = 0; c < MAG_CLASSES; c++)
+      st.cached += (uint64)*(volatile int*)&dcpus[id].mags[c].n * (c + 1) * ALIGNMENT_SIZE;
+  }
+  acquire(&dmem.lock);
+  st.inuse += dmem.inuse;
+  st.nalloc += dmem.nalloc;
+  st.nfree += dmem.nfree;
+  st.freebytes = dmem.freebytes;
+  st.nfreeblocks = dmem.nfreeblocks;
+  st.largest = largest_free();
+  memmove(st.hist, dmem.nbin, sizeof(st.hist));
   release(&dmem.lock);
-  // If no header with the given address is found, panic.
-  panic("dfree: Invalid address.");
+  if (dmem.lock.stat)
+    st.contended = dmem.lock.stat->contended;
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
 }
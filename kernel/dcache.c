@@ -0,0 +1,189 @@
+/*
+ * directory name cache for dirlookup()
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.1
+ * update log:
+ * v1.0 -- dclookup(), dcenter() and dcpurge(), hashed by (dir, name)
+ * v1.1 -- dclookup() takes no lock, entries freed through rcucall()
+ */
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDCACHE 256   // cached names
+#define NDHASH 61     // hash chains
+
+/*
+ * One name in directory dir. inum 0 is a negative entry: the
+ * name is known not to be there. off is the offset of the
+ * dirent, for dirlookup()'s callers that rewrite it.
+ *
+ * Entries of a directory only change while its inode is
+ * locked (dirlookup(), dirlink() and sys_unlink() all hold
+ * it), so the cache agrees with the directory's content.
+ * dcache.lock serializes the changes to the table itself, and
+ * dclookup() walks the hash chains without it: an entry is
+ * never changed once on a chain, but replaced by a new one,
+ * and only freed by rcucall() once no lookup can be using it.
+ */
+struct dentry {
+  struct rcuhead rcu;   // First, for dcfree().
+  uint dev;
+  uint dir;             // Inode number of the directory.
+  uint inum;            // Inode the name refers to, 0 if none.
+  uint off;             // Offset of the dirent in dir.
+  char name[DIRSIZ];
+  struct dentry *hnext; // Hash chain.
+  struct dentry *prev;  // Age list, under dcache.lock.
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct dentry *hash[NDHASH];
+  struct dentry *oldest; // Age list, next to replace first.
+  struct dentry *newest;
+  int n;                 // Entries in the table.
+} dcache;
+
+void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+  if((dcache.cache = kmem_cache_create("dentry", sizeof(struct dentry), 0)) == 0)
+    panic("dcinit");
+}
+
+static uint
+dchash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in dir on chain h. Caller must hold
+// dcache.lock, or be between rcureadlock() and rcureadunlock().
+static struct dentry*
+dcfind(uint dev, uint dir, char *name, uint h)
+{
+  struct dentry *d;
+
+  for(d = *(struct dentry* volatile*)&dcache.hash[h]; d;
+      d = *(struct dentry* volatile*)&d->hnext)
+    if(d->dev == dev && d->dir == dir && strncmp(d->name, name, DIRSIZ) == 0)
+      return d;
+  return 0;
+}
+
+static void
+dcfree(struct rcuhead *h)
+{
+  kmem_cache_free(dcache.cache, (struct dentry*)h);
+}
+
+// Take entry d out of the table; lookups already walking past
+// it may still read it until the grace period is over.
+// Caller must hold dcache.lock.
+static void
+dcremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dchash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  if(d->prev)
+    d->prev->next = d->next;
+  else
+    dcache.oldest = d->next;
+  if(d->next)
+    d->next->prev = d->prev;
+  else
+    dcache.newest = d->prev;
+  dcache.n--;
+  rcucall(&d->rcu, dcfree);
+}
+
+// Look name up in directory dir. Returns 1 and sets *inum
+// (0 for a negative entry) and *off if the name is cached.
+int
+dclookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  rcureadlock();
+  if((d = dcfind(dev, dir, name, dchash(dev, dir, name))) == 0){
+    rcureadunlock();
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  rcureadunlock();
+  return 1;
+}
+
+// Record that name in dir refers to inum (0: is absent),
+// replacing any entry for it. The oldest entry makes room
+// once the table is full, so rarely used names age out.
+void
+dcenter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h = dchash(dev, dir, name);
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dev, dir, name, h)) != 0)
+    dcremove(d);
+  if(dcache.n == NDCACHE)
+    dcremove(dcache.oldest);
+  if((d = kmem_cache_alloc(dcache.cache)) == 0){
+    release(&dcache.lock);
+    return;
+  }
+  d->dev = dev;
+  d->dir = dir;
+  d->inum = inum;
+  d->off = off;
+  strncpy(d->name, name, DIRSIZ);
+  d->prev = dcache.newest;
+  d->next = 0;
+  if(dcache.newest)
+    dcache.newest->next = d;
+  else
+    dcache.oldest = d;
+  dcache.newest = d;
+  dcache.n++;
+  d->hnext = dcache.hash[h];
+  // lookups must see the entry filled in before they find it.
+  __sync_synchronize();
+  dcache.hash[h] = d;
+  release(&dcache.lock);
+}
+
+// Forget every name in directory dir. ialloc() calls this
+// when a directory reuses the inode number of a freed one.
+void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d, *next;
+
+  acquire(&dcache.lock);
+  for(d = dcache.oldest; d; d = next){
+    next = d->next;
+    if(d->dev == dev && d->dir == dir)
+      dcremove(d);
+  }
+  release(&dcache.lock);
+}
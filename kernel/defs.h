@@ -1,13 +1,27 @@
+struct arena;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
+struct iovec;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct rwlock;
+struct rcuhead;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vmseg;
+struct vdso;
+struct vma;
+
+// arena.c
+void*           arena_alloc(struct arena*, uint64);
+void            arena_trim(struct arena*, void*, uint64);
+void            arena_reset(struct arena*);
 
 // bio.c
 void            binit(void);
@@ -16,6 +30,12 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+void            bwrite_start(struct buf*);
+void            bwait(struct buf*);
+void            bwrite_many(struct buf**, int);
+extern struct iostat iost;
+int             iostat(uint64);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +44,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+int             vmsegread(struct vmseg*, char*, uint64);
+void            vmsegput(struct vmseg*);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,6 +56,17 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             fdgrow(struct proc*, int);
+void            fdfree(struct proc*);
+
+// dcache.c
+void            dcinit(void);
+int             dclookup(uint, uint, char*, uint*, uint*);
+void            dcenter(uint, uint, char*, uint, uint);
+void            dcpurge(uint, uint);
 
 // fs.c
 void            fsinit(int);
@@ -42,6 +76,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+int             ilockfault(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -50,6 +85,11 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+struct buf*     ibread(struct inode*, uint);
+int             iinline(struct inode*);
+int             iexpand(struct inode*, uint);
+void            idatawrite(struct inode*);
+void            ishrink(struct inode*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -57,29 +97,65 @@ void            itrunc(struct inode*);
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdisk_rw(struct buf*, int);
+void            ramdisk_rwv(struct buf**, int, int);
+void            ramdisk_submit(struct buf**, int, int);
+uchar*          ramdisk_block(uint);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzero_idle(void);
+void            krefinc(void *);
+int             krefcnt(void *);
+int             krefdrop(void *);
+int             kfreepages(void);
+int             klargestfree(void);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
 
+// slab.c
+void            kmem_cache_init(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // dalloc.c
 void*           dalloc(unsigned size);
 void            dfree(void *);
 void            dinit(void);
+void*           drealloc(void *, unsigned size);
+void*           dalloc_aligned(unsigned size, unsigned align);
+void            dheapinfo(uint64*, uint64*);
+int             dstat(uint64);
+
+// mmap.c
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+uint64          mmapbase(struct proc*);
+struct vma*     vmafind(struct proc*, uint64);
+int             vmaread(struct vma*, char*, uint64);
+int             vmacopy(struct proc*, struct proc*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipewait(struct pipe*, int);
+int             pipefromi(struct pipe*, struct inode*, uint, int);
+int             pipetoi(struct pipe*, struct inode*, uint, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -90,10 +166,14 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*);
+int             kproc(char*, void (*)(void));
+void            reaperinit(void);
+int             reapnow(void);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -108,13 +188,19 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            timeryield(void);
+int             setpriority(int, int);
+int             setaffinity(int, int);
+int             clone(uint64, uint64, uint64);
+int             join(int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 int             getprocs(void);
+int             procstat(uint64, int);
 
 // memtest.c
-int             memtest(void);
+int             memtest(int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -123,12 +209,34 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initticket(struct spinlock*, char*);
 void            release(struct spinlock*);
+int             lockstats(uint64, int);
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+void            profstart(void);
+int             profstop(void);
+int             profread(uint64, int);
+
+// rcu.c
+void            rcuinit(void);
+void            rcureadlock(void);
+void            rcureadunlock(void);
+void            rcucall(struct rcuhead*, void (*)(struct rcuhead*));
+void            rcupoll(void);
 void            push_off(void);
 void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -149,18 +257,45 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             sysstats(uint64, int);
 
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+extern struct vdso *vdso;
 void            usertrapret(void);
+int             ticksleep(int);
+void            timerpark(int);
+void            timerresume(int);
+void            timerpoke(int);
+
+// trace.c
+extern uint     tracemask;
+void            traceinit(void);
+void            traceevent(int, uint64, uint64);
+int             tracectl(int);
+int             traceread(uint64, int);
+
+// swap.c
+void            swapinit(struct superblock*);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+int             swapout(void);
+int             swapreclaim(void);
+int             swapin(pagetable_t, uint64);
+
+// textcache.c
+void            textinit(void);
+char*           textpage(struct vmseg*, uint64, int*);
+void            textinval(struct inode*);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+int             uartwrite(char*, int);
+void            uartputc_async(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -174,10 +309,19 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, uint64);
+int             uvmshare(pagetable_t, uint64, void *);
+void            uvmprefault(uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+struct spinlock* ptlock(pagetable_t);
+int             kvmasid(int);
+void            uvmflush(pagetable_t, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -192,7 +336,28 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_submit(struct buf **, int, int);
 void            virtio_disk_intr(void);
 
+// the disk bio.c and swap.c use, by the MEMDISK build option.
+#if MEMDISK
+#define disk_init       ramdiskinit
+#define disk_intr       ramdiskintr
+#define disk_rw         ramdisk_rw
+#define disk_rwv        ramdisk_rwv
+#define disk_submit     ramdisk_submit
+#else
+#define disk_init       virtio_disk_init
+#define disk_intr       virtio_disk_intr
+#define disk_rw         virtio_disk_rw
+#define disk_rwv        virtio_disk_rwv
+#define disk_submit     virtio_disk_submit
+#endif
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+// record a tracepoint if its event is on (see trace.c).
+#define TRACE(ev, a, b) \
+  do { if(tracemask & (1 << (ev))) traceevent((ev), (uint64)(a), (uint64)(b)); } while(0)
@@ -0,0 +1,15 @@
+// State of the dalloc heap, see dstat().
+#define DSTAT_NBINS 21 // Free-block size classes: 16B << i up to 16MB.
+
+struct dstat {
+  uint64 heapsize;    // Bytes in the heap, headers included.
+  uint64 inuse;       // Bytes in allocated blocks, headers excluded.
+  uint64 cached;      // Bytes freed but parked in per-CPU magazines.
+  uint64 freebytes;   // Bytes in free blocks, headers excluded.
+  uint64 nfreeblocks; // Free blocks.
+  uint64 largest;     // Bytes in the largest free block.
+  uint64 nalloc;      // dalloc() calls that succeeded.
+  uint64 nfree;       // dfree() calls.
+  uint64 contended;   // dmem.lock acquisitions that had to wait.
+  uint64 hist[DSTAT_NBINS]; // Free blocks in each size class.
+};
@@ -5,6 +5,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 #include "elf.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
@@ -21,16 +24,26 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Load the program at path into a fresh page table for p, which
+// is the caller or, for spawn(), a child not yet running. The
+// caller's arena holds the scratch space.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  int i, off, nseg = 0;
+  uint64 argc, sz = 0, sp, *ustack, stackbase, oldtfva;
+  struct vmseg seg[NVMSEG];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
+  memset(seg, 0, sizeof(seg));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -61,9 +74,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(nseg < NVMSEG){
+      // Demand-page the segment: uvmlazy() reads each page
+      // from the file when the program first touches it.
+      seg[nseg].ip = idup(ip);
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].perm = flags2perm(ph.flags);
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
+    p->npages += (PGROUNDUP(sz1) - PGROUNDUP(sz)) / PGSIZE;
     sz = sz1;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
@@ -72,7 +100,6 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -82,12 +109,16 @@ exec(char *path, char **argv)
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
+  p->npages += 2;
   sz = sz1;
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
 
-  // Push argument strings, prepare rest of stack in ustack.
+  // Push argument strings, prepare rest of stack in ustack,
+  // which lives until sys_exec() resets the arena.
+  if((ustack = arena_alloc(&myproc()->arena, (MAXARG+1) * sizeof(uint64))) == 0)
+    goto bad;
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
       goto bad;
@@ -121,25 +152,72 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
+  oldtfva = p->tfva;
   p->pagetable = pagetable;
+  p->tfva = TRAPFRAME;
+  // a thread gets an ASID again (see clone()).
+  p->asid = kvmasid(p - proc);
+  p->tlbgen++;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  proc_freepagetable(oldpagetable, oldsz, oldtfva);
+  begin_op();
+  vmsegput(p->seg);
+  end_op();
+  memmove(p->seg, seg, sizeof(seg));
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable, sz, TRAPFRAME);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  begin_op();
+  vmsegput(seg);
+  end_op();
   return -1;
 }
 
+// Read the file-backed part of the page at va, which lies in
+// segment s, into mem. The rest of the page is left alone.
+// Returns 0 on success, -1 on failure.
+int
+vmsegread(struct vmseg *s, char *mem, uint64 va)
+{
+  uint64 o = va - s->va;
+  uint n;
+  int r, locked;
+
+  if(o >= s->filesz)
+    return 0;
+  n = s->filesz - o < PGSIZE ? s->filesz - o : PGSIZE;
+  if((locked = ilockfault(s->ip)) < 0)
+    return -1;
+  r = readi(s->ip, 0, (uint64)mem, s->off + o, n);
+  if(locked)
+    iunlock(s->ip);
+  return r == n ? 0 : -1;
+}
+
+// Drop the inode references of a segment table.
+// Must be called inside a transaction.
+void
+vmsegput(struct vmseg *seg)
+{
+  for(int i = 0; i < NVMSEG; i++){
+    if(seg[i].ip){
+      iput(seg[i].ip);
+      seg[i].ip = 0;
+    }
+  }
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
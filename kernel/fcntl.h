@@ -3,3 +3,31 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() protection and flags
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+
+// readv() and writev() buffers
+#define IOV_MAX 16  // buffers per call
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+
+// ringenter() operations
+#define RING_READ  1  // read(fd, addr, n)
+#define RING_WRITE 2  // write(fd, addr, n)
+#define RING_OPEN  3  // open(addr, fd)
+#define RING_CLOSE 4  // close(fd)
+#define RING_MAX 64   // entries per call
+struct ringent {
+  int op;
+  int fd;       // descriptor, or open mode for RING_OPEN
+  uint64 addr;  // buffer, or path for RING_OPEN
+  int n;
+  int res;      // result, filled in by ringenter()
+};
@@ -12,17 +12,20 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
-struct {
-  struct spinlock lock;
-  struct file file[NFILE];
-} ftable;
+
+// Open files come from a slab cache, and their reference
+// counts are updated atomically, so opening and closing files
+// on different harts share no lock.
+static struct kmem_cache *file_cache;
 
 void
 fileinit(void)
 {
-  initlock(&ftable.lock, "ftable");
+  if((file_cache = kmem_cache_create("file", sizeof(struct file), 0)) == 0)
+    panic("fileinit");
 }
 
 // Allocate a file structure.
@@ -31,27 +34,19 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(file_cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if(__sync_fetch_and_add(&f->ref, 1) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
@@ -60,18 +55,14 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  int ref;
 
-  acquire(&ftable.lock);
-  if(f->ref < 1)
-    panic("fileclose");
-  if(--f->ref > 0){
-    release(&ftable.lock);
+  if((ref = __sync_sub_and_fetch(&f->ref, 1)) > 0)
     return;
-  }
+  if(ref < 0)
+    panic("fileclose");
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
-  release(&ftable.lock);
+  kmem_cache_free(file_cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -82,6 +73,55 @@ fileclose(struct file *f)
   }
 }
 
+// Descriptor tables start as the NOFILE slots in struct proc,
+// and grow into 2^order pages of file pointers as needed.
+#define FDPERPAGE (PGSIZE / sizeof(struct file*))
+
+static int
+fdorder(int n)
+{
+  int order;
+
+  for(order = 0; (FDPERPAGE << order) < n; order++)
+    ;
+  return order;
+}
+
+// Grow p's descriptor table to at least n slots.
+// Returns 0 on success, -1 if n is too large or out of memory.
+int
+fdgrow(struct proc *p, int n)
+{
+  struct file **t;
+  int order;
+
+  if(n <= p->nofile)
+    return 0;
+  if(n > NOFILEMAX)
+    return -1;
+  order = fdorder(n);
+  if((t = kalloc_pages(order)) == 0)
+    return -1;
+  memset(t, 0, PGSIZE << order);
+  memmove(t, p->ofile, p->nofile * sizeof(struct file*));
+  fdfree(p);
+  p->ofile = t;
+  p->nofile = FDPERPAGE << order;
+  return 0;
+}
+
+// Give back p's grown descriptor table, whose files must have
+// been closed, and return to the slots in struct proc.
+void
+fdfree(struct proc *p)
+{
+  if(p->ofile && p->ofile != p->ofile0)
+    kfree_pages(p->ofile, fdorder(p->nofile));
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -101,6 +141,23 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Whether a copy to or from user memory under an inode lock
+// failed because a page fault gave up on another inode's lock
+// (see ilockfault()). If so, page in the rest of the buffer,
+// [addr, addr+n), while no inode is locked, so that the copy
+// can be retried once. Caller must hold no inode lock.
+static int
+faultretry(uint64 addr, uint64 n)
+{
+  struct proc *p = myproc();
+
+  if(!p->ifaulted)
+    return 0;
+  p->ifaulted = 0;
+  uvmprefault(addr, n);
+  return 1;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -118,10 +175,14 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    for(int retry = 0; ; retry = 1){
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      if(r >= 0 || retry || !faultretry(addr, n))
+        break;
+    }
   } else {
     panic("fileread");
   }
@@ -129,12 +190,74 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Write the user buffers of iov[0..cnt) to inode file f, one
+// after the other. As many of them as fit in a transaction are
+// written in one, under one lock of the inode. Returns the
+// number of bytes written, or -1 if not all could be.
+static int
+inodewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, up to three indirect blocks (the double-
+  // indirect one and two below it), allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
+  int r, n1, left = 0, tot = 0, err = 0, open = 0, retry = 0;
+  uint64 addr, n;
+
+  for(int i = 0; i < cnt && !err; i++){
+    addr = (uint64)iov[i].iov_base;
+    for(n = iov[i].iov_len; n > 0; n -= r, addr += r){
+      if(left == 0){
+        // this transaction's share is used up.
+        if(open){
+          iunlock(f->ip);
+          end_op();
+        }
+        begin_op();
+        ilock(f->ip);
+        open = 1;
+        left = max;
+      }
+      n1 = n < left ? n : left;
+      if((r = writei(f->ip, 1, addr, f->off, n1)) > 0)
+        f->off += r;
+      if(r < 0)
+        r = 0;
+      tot += r;
+      left -= r;
+      if(r != n1){
+        iunlock(f->ip);
+        end_op();
+        open = 0;
+        left = 0;
+        if(!retry && faultretry(addr + r, n - r)){
+          retry = 1;
+          continue;
+        }
+        // error from writei
+        err = 1;
+        break;
+      }
+      retry = 0;
+    }
+  }
+  if(open){
+    iunlock(f->ip);
+    end_op();
+  }
+  return err ? -1 : tot;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
@@ -146,37 +269,127 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+    struct iovec v = { (void*)addr, n };
+    ret = inodewritev(f, &v, 1);
+  } else {
+    panic("filewrite");
+  }
 
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+  return ret;
+}
 
-      if(r != n1){
-        // error from writei
-        break;
+// Read from file f into the user buffers of iov[0..cnt), one
+// after the other, stopping at the first that is not filled.
+// An inode is locked once for all of them.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int r = 0, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    for(int i = 0, retry = 0; i < cnt; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len)) < 0){
+        iunlock(f->ip);
+        if(retry || !faultretry((uint64)iov[i].iov_base, iov[i].iov_len))
+          return tot > 0 ? tot : -1;
+        retry = 1;
+        i--;
+        ilock(f->ip);
+        continue;
       }
-      i += r;
+      retry = 0;
+      f->off += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
     }
-    ret = (i == n ? n : -1);
+    iunlock(f->ip);
   } else {
-    panic("filewrite");
+    for(int i = 0; i < cnt; i++){
+      if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        break;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
   }
+  return r < 0 && tot == 0 ? -1 : tot;
+}
 
-  return ret;
+// Write the user buffers of iov[0..cnt) to file f, in order.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int r, tot = 0;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type == FD_INODE)
+    return inodewritev(f, iov, cnt);
+  for(int i = 0; i < cnt; i++){
+    if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
 }
 
+// Move up to n bytes from file in to file out inside the
+// kernel, between a pipe's ring and the buffer cache, for
+// splice(). One of them must be an inode and the other a pipe.
+// Returns the number of bytes moved, 0 at the end of in,
+// or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  // same transaction budget as filewrite().
+  int max = ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
+  int r = 0, tot = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    while(tot < n){
+      if((r = pipewait(out->pipe, 1)) < 0)
+        break;
+      ilock(in->ip);
+      if(in->off >= in->ip->size){
+        iunlock(in->ip);
+        break;
+      }
+      // 0: another writer took the room meanwhile.
+      if((r = pipefromi(out->pipe, in->ip, in->off, n - tot)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      if(r < 0)
+        break;
+      tot += r;
+    }
+  } else if(in->type == FD_PIPE && out->type == FD_INODE){
+    while(tot < n){
+      if((r = pipewait(in->pipe, 0)) <= 0)
+        break;
+      begin_op();
+      ilock(out->ip);
+      // 0: another reader drained the pipe meanwhile.
+      if((r = pipetoi(in->pipe, out->ip, out->off, n - tot < max ? n - tot : max)) > 0)
+        out->off += r;
+      iunlock(out->ip);
+      end_op();
+      if(r < 0)
+        break;
+      tot += r;
+    }
+  } else {
+    return -1;
+  }
+  return tot > 0 || r >= 0 ? tot : -1;
+}
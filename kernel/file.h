@@ -18,15 +18,21 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *lprev; // itable LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint rapos;         // offset where the last readi() ended
+  uint ranext;        // first block not read ahead yet
+  int textcached;     // has pages in the text cache (see textcache.c)
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
@@ -22,10 +22,19 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// blocks read ahead of a sequential reader, see readi().
+#define READAHEAD 8
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// Where each CPU's next allocation without a goal starts. The
+// CPUs start in different parts of the disk, so files written
+// on different harts at once don't interleave their blocks.
+// Only a hint: racing updates just cost locality.
+static uint bhint[NCPU];
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -43,7 +52,10 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  for(int i = 0; i < NCPU; i++)
+    bhint[i] = sb.size / NCPU * i;
   initlog(dev, &sb);
+  swapinit(&sb);
 }
 
 // Zero a block.
@@ -60,33 +72,68 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Find a free block in [start, end), mark it in use and return it.
+// Returns 0 if there is none; block 0 is the boot block and never free.
+// The bitmap is tested 64 bits at a time; bp->data follows the
+// pointers in struct buf, so it is 8-byte aligned.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint start, uint end)
 {
-  int b, bi, m;
+  uint b, bi;
+  uint64 *w, m, free;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  b = start;
+  while(b < end){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+    do {
+      w = (uint64*)bp->data + (b % BPB) / 64;
+      free = ~*w & (~0UL << (b % 64));
+      if(free){
+        for(m = 1, bi = b - b % 64; (free & m) == 0; m <<= 1)
+          bi++;
+        if(bi < end){
+          *w |= m;  // Mark block in use.
+          log_write(bp);
+          brelse(bp);
+          return bi;
+        }
+        b = end;
+        break;
       }
-    }
+      b += 64 - b % 64;
+    } while(b < end && b % BPB != 0);
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a zeroed disk block, the first free one at or
+// after goal, so a caller passing the block just before
+// lays its data out contiguously. Without a goal (0), carry
+// on from this CPU's last allocation.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, *hint;
+
+  push_off();
+  hint = &bhint[cpuid()];
+  pop_off();
+  if(goal == 0)
+    goal = *hint;
+  if(goal >= sb.size)
+    goal = 0;
+  if((b = bscan(dev, goal, sb.size)) == 0 && (b = bscan(dev, 0, goal)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  *hint = b + 1;
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -165,28 +212,162 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Entries are hashed by (dev, inum). Once its last reference
+// goes, an entry stays hashed with its contents still valid,
+// on an LRU list of unused entries, so that iget() of an inode
+// used a moment ago doesn't re-read it. A miss recycles the
+// entry unused the longest. Like the buffer cache, the table
+// starts with NINODE entries and grows from a slab cache up to
+// NINODEMAX while more than INODEMINFREE pages are free; when
+// free memory drops below half of that, misses hand grown
+// entries back instead.
+#define NIHASH 61
+#define INODEMINFREE 1024
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;      // unused entries, most recent first
+  struct inode *lrutail;
+  struct kmem_cache *cache;   // entries beyond the first NINODE
+  int ninode;                 // entries in the table
 } itable;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &itable.hash[(dev * 31 + inum) % NIHASH];
+}
+
+static void
+ihash_remove(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      return;
+    }
+  }
+}
+
+static void
+lru_remove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    itable.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    itable.lrutail = ip->lprev;
+}
+
+static void
+lru_push(struct inode *ip)
+{
+  ip->lprev = 0;
+  ip->lnext = itable.lruhead;
+  if(itable.lruhead)
+    itable.lruhead->lprev = ip;
+  else
+    itable.lrutail = ip;
+  itable.lruhead = ip;
+}
+
+static void
+iinitentry(struct inode *ip)
+{
+  initsleeplock(&ip->lock, "inode");
+  ip->dev = 0;    // not hashed
+  ip->ref = 0;
+  ip->textcached = 0;
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  if((itable.cache = kmem_cache_create("inode", sizeof(struct inode), 0)) == 0)
+    panic("iinit");
   for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+    iinitentry(&itable.inode[i]);
+    lru_push(&itable.inode[i]);
   }
+  itable.ninode = NINODE;
+}
+
+static int
+igrown(struct inode *ip)
+{
+  return ip < itable.inode || ip >= itable.inode+NINODE;
+}
+
+// Take the entry unused the longest off the LRU list and out
+// of the hash table, or return 0 if every entry is in use.
+// Caller must hold itable.lock.
+static struct inode*
+ievict(void)
+{
+  struct inode *ip;
+
+  if((ip = itable.lrutail) == 0)
+    return 0;
+  lru_remove(ip);
+  if(ip->textcached)
+    textinval(ip);
+  if(ip->dev)
+    ihash_remove(ip);
+  return ip;
+}
+
+// Find an entry for an inode not in the table: a new one while
+// memory is plentiful, else a recycled one, allocating anyway
+// if all are in use.
+// Caller must hold itable.lock.
+static struct inode*
+inew(void)
+{
+  struct inode *ip;
+  int nfree = kfreepages();
+
+  // give an old entry back when memory runs low.
+  if(nfree < INODEMINFREE / 2 && itable.ninode > NINODE &&
+     (ip = ievict()) != 0){
+    if(!igrown(ip))
+      return ip;
+    kmem_cache_free(itable.cache, ip);
+    itable.ninode--;
+  }
+
+  if(itable.ninode < NINODEMAX && nfree > INODEMINFREE &&
+     (ip = kmem_cache_alloc(itable.cache)) != 0){
+    iinitentry(ip);
+    itable.ninode++;
+    return ip;
+  }
+  if((ip = ievict()) != 0)
+    return ip;
+  if(itable.ninode < NINODEMAX && (ip = kmem_cache_alloc(itable.cache)) != 0){
+    iinitentry(ip);
+    itable.ninode++;
+    return ip;
+  }
+  return 0;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -210,6 +391,8 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      if(type == T_DIR)
+        dcpurge(dev, inum);  // names left from an earlier directory
       return iget(dev, inum);
     }
     brelse(bp);
@@ -246,31 +429,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode entry.
-  if(empty == 0)
+  if((ip = inew()) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->rapos = 0;
+  ip->ranext = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&itable.lock);
 
   return ip;
@@ -287,19 +471,15 @@ idup(struct inode *ip)
   return ip;
 }
 
-// Lock the given inode.
-// Reads the inode from disk if necessary.
-void
-ilock(struct inode *ip)
+// Read the locked inode from disk if necessary.
+static void
+iload(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
 
-  if(ip == 0 || ip->ref < 1)
-    panic("ilock");
-
-  acquiresleep(&ip->lock);
-
+  if(myproc())
+    myproc()->ilocks++;
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
@@ -316,6 +496,46 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode.
+// Reads the inode from disk if necessary.
+void
+ilock(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock");
+
+  acquiresleep(&ip->lock);
+  iload(ip);
+}
+
+// Lock ip to read a page of it in for a page fault. The fault
+// may strike while a copy to or from user memory runs under
+// another inode's lock, in readi() or writei(); waiting for ip
+// then could deadlock with a process faulting the other way
+// round, so give up instead and set p->ifaulted, after which
+// fileread() and filewrite() retry without their locks.
+// Returns 1 if the caller must iunlock(ip), 0 if it already
+// held the lock, as when write() copies from a mapping of the
+// very file it writes, or -1 if it gave up.
+int
+ilockfault(struct inode *ip)
+{
+  struct proc *p = myproc();
+
+  if(holdingsleep(&ip->lock))
+    return 0;
+  if(p->ilocks == 0){
+    ilock(ip);
+    return 1;
+  }
+  if(!tryacquiresleep(&ip->lock)){
+    p->ifaulted = 1;
+    return -1;
+  }
+  iload(ip);
+  return 1;
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -323,6 +543,8 @@ iunlock(struct inode *ip)
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  if(myproc())
+    myproc()->ilocks--;
   releasesleep(&ip->lock);
 }
 
@@ -357,7 +579,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    lru_push(ip);
   release(&itable.lock);
 }
 
@@ -374,20 +597,54 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT
+// after those in the indirect blocks listed in the double-
+// indirect block ip->addrs[NDIRECT+1].
+
+// Return entry bn of indirect block addr, allocating it if
+// necessary next to the entry before it (or to addr itself).
+// returns 0 if out of disk space.
+static uint
+bmapind(uint dev, uint addr, uint bn)
+{
+  uint *a, b;
+  struct buf *bp;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  if((b = a[bn]) == 0){
+    b = balloc(dev, (bn > 0 && a[bn-1] ? a[bn-1] : addr) + 1);
+    if(b){
+      a[bn] = b;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return b;
+}
+
+// Whether ip's data lives in ip->addrs: that of a regular file
+// no larger than NINLINE bytes, which reads and writes from the
+// in-memory inode without a block of its own.
+// Caller must hold ip->lock.
+int
+iinline(struct inode *ip)
+{
+  return ip->type == T_FILE && ip->size <= NINLINE;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 // returns 0 if out of disk space.
+// ip's data must be in blocks, not inline.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -399,35 +656,59 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->addrs[NDIRECT-1] ? ip->addrs[NDIRECT-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+    return bmapind(ip->dev, addr, bn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block below it.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = balloc(ip->dev, ip->addrs[NDIRECT] ? ip->addrs[NDIRECT] + 1 : 0);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr;
     }
-    brelse(bp);
-    return addr;
+    if((addr = bmapind(ip->dev, addr, bn / NINDIRECT)) == 0)
+      return 0;
+    return bmapind(ip->dev, addr, bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Free indirect block addr and, depth levels down, the
+// blocks it lists.
+static void
+bfreeind(uint dev, uint addr, int depth)
 {
-  int i, j;
   struct buf *bp;
   uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Free the blocks of ip, leaving ip->size alone.
+static void
+ifreeblocks(struct inode *ip)
+{
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,21 +718,89 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  idatawrite(ip);
+  if(iinline(ip))
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  else
+    ifreeblocks(ip);
   ip->size = 0;
   iupdate(ip);
 }
 
+// Call before changing ip's data, by any path, so that no
+// copy of it cached elsewhere outlives the change.
+// Caller must hold ip->lock.
+void
+idatawrite(struct inode *ip)
+{
+  if(ip->textcached)
+    textinval(ip);
+}
+
+// Make ip ready to grow to end bytes: if its data is inline
+// and would no longer fit, move it to a block of its own.
+// Returns 1 if it moved, 0 if not, -1 if out of disk space.
+// Caller must hold ip->lock, inside a transaction.
+int
+iexpand(struct inode *ip, uint end)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+
+  if(!iinline(ip) || end <= NINLINE)
+    return 0;
+  memmove(data, ip->addrs, ip->size);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0)) == 0){
+      memmove(ip->addrs, data, ip->size);
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  return 1;
+}
+
+// Undo iexpand() for a write that fell short, leaving ip small
+// enough to be inline again: move its data back into ip->addrs
+// and free its blocks.
+// Caller must hold ip->lock, inside a transaction.
+void
+ishrink(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+
+  memset(data, 0, sizeof(data));
+  if(ip->addrs[0]){
+    bp = bread(ip->dev, ip->addrs[0]);
+    memmove(data, bp->data, ip->size);
+    brelse(bp);
+  }
+  ifreeblocks(ip);
+  memmove(ip->addrs, data, sizeof(data));
+  iupdate(ip);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -464,6 +813,26 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading blocks [bn, last] of ip into the buffer
+// cache, skipping ones read ahead before, and stopping at the
+// end of the file.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint addr;
+
+  if(bn < ip->ranext)
+    bn = ip->ranext;
+  for(; bn <= last && bn < (ip->size + BSIZE - 1) / BSIZE; bn++){
+    // blocks below the size are allocated, so bmap() only looks.
+    if((addr = bmap(ip, bn)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  ip->ranext = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -479,6 +848,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(iinline(ip)){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  // a read that starts where the last one ended is likely to be
+  // followed by more: have the disk fetch the blocks after this
+  // read while it copies out the first ones.
+  if(off != ip->rapos)
+    ip->ranext = 0;
+  else if(n > 0)
+    readahead(ip, off/BSIZE + 1, (off + n - 1)/BSIZE + READAHEAD);
+  ip->rapos = off + n;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -495,6 +879,30 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Return the locked buffer holding byte off of ip, allocating
+// the block if it has none yet, or 0 if out of disk space. For
+// splice(), which copies between the buffer and a pipe without
+// a user buffer in between. Keeps read-ahead going for a reader
+// that continues at ip->rapos, as readi() does; such a caller
+// moves ip->rapos past the bytes it used.
+// ip's data must be in blocks; see iinline().
+// Caller must hold ip->lock.
+struct buf*
+ibread(struct inode *ip, uint off)
+{
+  uint addr;
+
+  if(off < ip->size){
+    if(off != ip->rapos)
+      ip->ranext = 0;
+    else
+      readahead(ip, off/BSIZE + 1, off/BSIZE + READAHEAD);
+  }
+  if((addr = bmap(ip, off/BSIZE)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -507,11 +915,25 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int moved;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  idatawrite(ip);
+
+  if(iinline(ip) && off + n <= NINLINE){
+    // only the inode changes.
+    if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+      n = 0;
+    if(off + n > ip->size)
+      ip->size = off + n;
+    iupdate(ip);
+    return n;
+  }
+  if((moved = iexpand(ip, off + n)) < 0)
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -533,7 +955,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
   // block to ip->addrs[].
-  iupdate(ip);
+  if(moved && ip->size <= NINLINE)
+    ishrink(ip);
+  else
+    iupdate(ip);
 
   return tot;
 }
@@ -557,6 +982,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp->dev, dp->inum, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1000,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp->dev, dp->inum, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp->dev, dp->inum, name, 0, 0);
   return 0;
 }
 
@@ -601,6 +1036,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcenter(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
@@ -8,6 +8,7 @@
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
+// followed by the swap area, outside the file system's size.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +21,20 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of the swap area
+  uint nswap;        // Number of swap blocks
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// A regular file of at most NINLINE bytes keeps its data in
+// addrs[] itself, and has no blocks.
+#define NINLINE (sizeof(uint) * (NDIRECT+2))
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +43,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses, or inline data
 };
 
 // Inodes per block.
@@ -0,0 +1,25 @@
+// Buffer cache, disk and log counters, see iostat().
+struct iostat {
+  uint64 bhit;        // Block lookups found in the buffer cache.
+  uint64 bmiss;       // Block lookups that needed a buffer.
+  uint64 bevict;      // Cached blocks whose buffer was recycled.
+  uint64 nbuf;        // Buffers in the cache now.
+  uint64 bread;       // bread() calls.
+  uint64 bwrite;      // Blocks written by bwrite() and friends.
+  uint64 readahead;   // Reads started by breadahead().
+  uint64 dreq;        // Disk requests.
+  uint64 dblocks;     // Blocks moved by them.
+  uint64 dtime;       // Timer cycles from start to completion, summed.
+  uint64 dmaxtime;    // Longest request, in timer cycles.
+  uint64 dqueue;      // Requests in flight now.
+  uint64 dmaxqueue;   // Most requests in flight at once.
+  uint64 commits;     // Log commits that wrote blocks.
+  uint64 logblocks;   // Blocks they logged.
+  uint64 maxcommit;   // Largest commit, in blocks.
+  uint64 installs;    // Writebacks of committed blocks to their homes.
+  uint64 homeblocks;  // Blocks they wrote.
+  uint64 swapslots;   // Pages the swap area holds.
+  uint64 swapused;    // Slots in use now.
+  uint64 swapout;     // Pages evicted to swap.
+  uint64 swapin;      // Pages read back.
+};
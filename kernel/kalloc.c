@@ -1,6 +1,25 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous runs of 2^order pages.
+//
+// Free memory is managed by a buddy system: a free block of
+// order k is 2^k pages, aligned to its own size, and is merged
+// with its buddy (the other half of the enclosing order k+1
+// block) whenever both are free.
+//
+// Single pages go through per-CPU free lists in front of the
+// buddy system, so kalloc()/kfree() usually only take this
+// hart's lock. A hart whose list runs dry refills a batch from
+// the buddy system, or steals half of another hart's list once
+// the buddy system is empty.
+//
+// Harts with nothing to run zero free pages ahead of time and park
+// them on a pool that kalloc_zeroed() serves first.
+//
+// Every allocated page has a reference count, so that fork() can
+// share pages copy-on-write; kfree() only frees a page when its
+// last reference goes away.
 
 #include "types.h"
 #include "param.h"
@@ -8,58 +27,452 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "trace.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// DEBUG_ALLOC (set by the Makefile) fills freed and newly
+// allocated pages with junk to catch dangling references.
+#ifndef DEBUG_ALLOC
+#define DEBUG_ALLOC 1
+#endif
+
+// number of pages of RAM, free or not.
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER]; // free blocks of each order
+  // order+1 of the free block that starts at each
+  // page, or 0 if no free block starts there.
+  uchar freeorder[NPAGES];
+  int npages;                     // pages in the free lists
 } kmem;
 
+// references to each allocated page; 0 while the page is free.
+static int pagerefs[NPAGES];
+
+#define PCP_BATCH 32    // pages moved between a CPU list and the buddy system
+#define PCP_HIGH 128    // CPU list length that triggers a flush
+
+struct {
+  struct spinlock lock;
+  struct run *freelist; // free pages, singly linked through next
+  int n;                // length of freelist
+} kcpu[NCPU];
+
+#define ZPOOL_MAX 256  // pre-zeroed pages kept at most
+
+struct {
+  struct spinlock lock;
+  struct run *list;     // zeroed pages, except for the next link
+  int n;
+} kzero;
+
+static void pcp_refill(int id);
+
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)(PHYSTOP - HEAP_SIZE));
+  initticket(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(int id = 0; id < NCPU; id++)
+    initlock(&kcpu[id].lock, "kcpu");
+  freerange(end, (void*)PHYSTOP);
+
+  // give every hart a batch of pages to start with.
+  for(int id = 0; id < NCPU; id++){
+    acquire(&kcpu[id].lock);
+    pcp_refill(id);
+    release(&kcpu[id].lock);
+  }
+}
+
+static void
+list_push(int order, struct run *r)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.freeorder[PA2PG(r)] = order + 1;
+  kmem.npages += 1 << order;
+}
+
+static void
+list_remove(int order, struct run *r)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.freeorder[PA2PG(r)] = 0;
+  kmem.npages -= 1 << order;
+}
+
+// Put a free block on its list, merging it with its
+// buddy for as long as the buddy is free too.
+// kmem.lock must be held.
+static void
+buddy_free(char *pa, int order)
+{
+  while(order < MAXORDER - 1){
+    char *buddy = (char*)(KERNBASE + (((uint64)pa - KERNBASE) ^ ((uint64)PGSIZE << order)));
+    if(kmem.freeorder[PA2PG(buddy)] != order + 1)
+      break;
+    list_remove(order, (struct run*)buddy);
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  list_push(order, (struct run*)pa);
 }
 
+// Take a free block of the given order, splitting a
+// larger block if needed. Returns 0 if none is left.
+// kmem.lock must be held.
+static char*
+buddy_alloc(int order)
+{
+  int k;
+  char *pa;
+
+  for(k = order; k < MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k == MAXORDER)
+    return 0;
+
+  pa = (char*)kmem.freelist[k];
+  list_remove(k, (struct run*)pa);
+
+  // return the upper halves to the free lists.
+  while(k > order){
+    k--;
+    list_push(k, (struct run*)(pa + ((uint64)PGSIZE << k)));
+  }
+  return pa;
+}
+
+// Move a batch of pages from the buddy system to kcpu[id].
+// kcpu[id].lock must be held.
+static void
+pcp_refill(int id)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(kcpu[id].n < PCP_BATCH){
+    if((r = kmem.freelist[0]) != 0)
+      list_remove(0, r);
+    else if((r = (struct run*)buddy_alloc(0)) == 0)
+      break;
+    r->next = kcpu[id].freelist;
+    kcpu[id].freelist = r;
+    kcpu[id].n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move a batch of pages from kcpu[id] back to the buddy system
+// so they can merge again.
+// kcpu[id].lock must be held.
+static void
+pcp_flush(int id)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(kcpu[id].n > PCP_HIGH - PCP_BATCH){
+    r = kcpu[id].freelist;
+    kcpu[id].freelist = r->next;
+    kcpu[id].n--;
+    buddy_free((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+static struct run *zpool_take(void);
+
+// Give every hart's cached pages back to the buddy system,
+// for a multi-page allocation that could not be satisfied.
+static void
+pcp_drain(void)
+{
+  struct run *r;
+
+  for(int id = 0; id < NCPU; id++){
+    acquire(&kcpu[id].lock);
+    acquire(&kmem.lock);
+    while((r = kcpu[id].freelist) != 0){
+      kcpu[id].freelist = r->next;
+      buddy_free((char*)r, 0);
+    }
+    kcpu[id].n = 0;
+    release(&kmem.lock);
+    release(&kcpu[id].lock);
+  }
+
+  while((r = zpool_take()) != 0){
+    acquire(&kmem.lock);
+    buddy_free((char*)r, 0);
+    release(&kmem.lock);
+  }
+}
+
+// Take half of the pages of the first other hart that has any,
+// keep all but one on kcpu[id] and return that one.
+// Called without any kcpu lock held, so that two stealing harts
+// never wait for each other.
+static struct run*
+pcp_steal(int id)
+{
+  struct run *r, *first, *last;
+  int victim, n;
+
+  for(victim = (id + 1) % NCPU; victim != id; victim = (victim + 1) % NCPU){
+    acquire(&kcpu[victim].lock);
+    if(kcpu[victim].n == 0){
+      release(&kcpu[victim].lock);
+      continue;
+    }
+    n = (kcpu[victim].n + 1) / 2;
+    first = last = kcpu[victim].freelist;
+    for(int i = 1; i < n; i++)
+      last = last->next;
+    kcpu[victim].freelist = last->next;
+    kcpu[victim].n -= n;
+    release(&kcpu[victim].lock);
+
+    r = first;
+    if(n > 1){
+      acquire(&kcpu[id].lock);
+      last->next = kcpu[id].freelist;
+      kcpu[id].freelist = first->next;
+      kcpu[id].n += n - 1;
+      release(&kcpu[id].lock);
+    }
+    return r;
+  }
+  return 0;
+}
+
+// Hand [pa_start, pa_end) to the allocator as the largest
+// aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  int order;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)pa_end){
+    for(order = MAXORDER - 1; order > 0; order--){
+      uint64 sz = (uint64)PGSIZE << order;
+      if(((uint64)p - KERNBASE) % sz == 0 && p + sz <= (char*)pa_end)
+        break;
+    }
+    kfree_pages(p, order);
+    p += (uint64)PGSIZE << order;
+  }
+}
+
+// Free the 2^order pages of physical memory starting at pa,
+// which normally should have been returned by a call to
+// kalloc_pages(order).  (The exception is when
+// initializing the allocator; see kinit above.)
+void
+kfree_pages(void *pa, int order)
+{
+  if(order < 0 || order >= MAXORDER ||
+     ((uint64)pa % ((uint64)PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+
+#if DEBUG_ALLOC
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free(pa, order);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their total size. Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  char *pa;
+
+  if(order < 0 || order >= MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    // free pages cached by the harts may complete a block.
+    pcp_drain();
+    acquire(&kmem.lock);
+    pa = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+#if DEBUG_ALLOC
+  if(pa)
+    memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  TRACE(TR_KALLOC, order, pa);
+  return (void*)pa;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
   struct run *r;
+  int id;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // drop one reference; pages that were never handed out
+  // (see kinit) have none.
+  if(pagerefs[PA2PG(pa)] > 0 &&
+     __sync_sub_and_fetch(&pagerefs[PA2PG(pa)], 1) > 0)
+    return;
+
+#if DEBUG_ALLOC
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  pop_off();
+
+  acquire(&kcpu[id].lock);
+  r->next = kcpu[id].freelist;
+  kcpu[id].freelist = r;
+  if(++kcpu[id].n >= PCP_HIGH)
+    pcp_flush(id);
+  release(&kcpu[id].lock);
+}
+
+// Take a page off the pre-zeroed pool, or return 0.
+static struct run*
+zpool_take(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0; // the only non-zero word
+  return r;
+}
+
+// Take one page off this hart's list, stealing if needed,
+// and falling back on the pre-zeroed pool.
+static struct run*
+page_alloc(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+
+  acquire(&kcpu[id].lock);
+  if(kcpu[id].freelist == 0)
+    pcp_refill(id);
+  r = kcpu[id].freelist;
+  if(r){
+    kcpu[id].freelist = r->next;
+    kcpu[id].n--;
+  }
+  release(&kcpu[id].lock);
+
+  if(r == 0)
+    r = pcp_steal(id);
+  if(r == 0)
+    r = zpool_take();
+  return r;
+}
+
+// Called by scheduler() when this hart found nothing to run:
+// zero one page from this hart's list (never stolen) and
+// park it on the pre-zeroed pool, unless the pool is full.
+// Returns 0 if there was nothing to do.
+int
+kzero_idle(void)
+{
+  struct run *r;
+  int id;
+
+  if(kzero.n >= ZPOOL_MAX)
+    return 0;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+
+  acquire(&kcpu[id].lock);
+  if(kcpu[id].freelist == 0)
+    pcp_refill(id);
+  r = kcpu[id].freelist;
+  if(r){
+    kcpu[id].freelist = r->next;
+    kcpu[id].n--;
+  }
+  release(&kcpu[id].lock);
+  if(r == 0)
+    return 0;
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n < ZPOOL_MAX){
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    r = 0;
+  }
+  release(&kzero.lock);
+  if(r)
+    kfree(r);
+  return 1;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -67,16 +480,89 @@ kfree(void *pa)
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
+{
+  struct run *r = page_alloc();
+
+  if(r == 0)
+    return 0;
+  pagerefs[PA2PG(r)] = 1;
+#if DEBUG_ALLOC
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  TRACE(TR_KALLOC, 0, r);
+  return (void*)r;
+}
+
+// Allocate one page filled with zeros, for callers that
+// would clear it anyway; the page is written only once.
+void *
+kalloc_zeroed(void)
 {
   struct run *r;
 
+  if((r = zpool_take()) == 0){
+    if((r = page_alloc()) == 0)
+      return 0;
+    memset((char*)r, 0, PGSIZE);
+  }
+  pagerefs[PA2PG(r)] = 1;
+  return (void*)r;
+}
+
+// Roughly how many pages are free, for callers that size
+// caches by memory pressure. Takes no locks.
+int
+kfreepages(void)
+{
+  int n = *(volatile int*)&kmem.npages + *(volatile int*)&kzero.n;
+
+  for(int id = 0; id < NCPU; id++)
+    n += *(volatile int*)&kcpu[id].n;
+  return n;
+}
+
+// Pages in the largest free block of the buddy system, for
+// measuring fragmentation against kfreepages().
+int
+klargestfree(void)
+{
+  int order;
+
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  for(order = MAXORDER - 1; order >= 0 && kmem.freelist[order] == 0; order--)
+    ;
   release(&kmem.lock);
+  return order < 0 ? 0 : 1 << order;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+// Add a reference to an allocated page, which will then
+// take one more kfree() to be freed.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  __sync_fetch_and_add(&pagerefs[PA2PG(pa)], 1);
+}
+
+// Drop a reference to an allocated page, unless it is the last
+// one. Returns 1 if other references remain, 0 if the caller
+// holds the last one and should free the page with kfree().
+int
+krefdrop(void *pa)
+{
+  int n;
+
+  do {
+    if((n = pagerefs[PA2PG(pa)]) <= 1)
+      return 0;
+  } while(!__sync_bool_compare_and_swap(&pagerefs[PA2PG(pa)], n, n - 1));
+  return 1;
+}
+
+// Number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return pagerefs[PA2PG(pa)];
 }
@@ -0,0 +1,10 @@
+// Counters kept for all the spinlocks of one name, see lockstat().
+struct lockstat {
+  char name[16];
+  uint64 acquire;    // Acquisitions
+  uint64 contended;  // Acquisitions that found the lock held
+  uint64 spins;      // Loop iterations spent waiting
+  uint64 maxhold;    // Longest hold, in cycles
+};
+
+#define NLOCKSTAT 64   // lock names counted
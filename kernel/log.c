@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +22,23 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// With LOGDELAY set, the last end_op() leaves the transaction
+// open for more system calls to join, so that one commit covers
+// many of them. It is committed by the first begin_op() or
+// end_op() LOGDELAY ticks after it started, by the flusher thread
+// at most WBDELAY ticks later if none comes, once the log is half
+// full, or by fsync(); until then a crash loses it.
+//
+// A commit leaves the blocks it logged in the buffer cache,
+// pinned, instead of writing them home at once. Later commits
+// append to the log, so the log holds every committed update
+// not yet installed, and recovery replays them all in order.
+// The blocks go home together, each once however often it was
+// updated, when the log is half full or every WBDELAY ticks,
+// driven by the flusher thread. Once no FS system call runs,
+// the cache holds exactly what was committed, so the install
+// writes the cached blocks themselves.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,7 +46,11 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block updated again after a commit gets another entry, so
+// the header may name it more than once, the latest last.
+// Log appends are synchronous: commit() writes the new log
+// blocks with bwrite_many(), waiting for them before writing
+// the header that depends on them.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,15 +63,23 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // blocks it can hold: size less the header, at most LOGSIZE.
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int syncing;     // fsync() waits for the next commit.
+  int ncommit;     // commits so far.
+  int committed;   // entries of lh in the on-disk log, not installed.
+  int flushing;    // the flusher wants them installed.
+  uint opened;     // ticks when the open transaction began.
   int dev;
   struct logheader lh;
+  struct buf *bufs[LOGSIZE]; // for commit(), which runs alone.
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(int install);
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -60,26 +90,56 @@ initlog(int dev, struct superblock *sb)
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
   log.dev = dev;
   recover_from_log();
+  if(kproc("flusher", flusher) < 0)
+    panic("initlog: flusher");
+}
+
+// Whether entry i of the log header is followed by a newer
+// copy of the same block.
+static int
+superseded(int i)
+{
+  for(int j = i + 1; j < log.lh.n; j++)
+    if(log.lh.block[j] == log.lh.block[i])
+      return 1;
+  return 0;
 }
 
-// Copy committed blocks from log to their home location
+// Write the committed blocks to their home locations, each
+// once, sorted by block number. When recovering, their contents
+// come from the log; otherwise from the cache, where they are
+// pinned.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  int tail, n = 0;
+  struct buf **dbufs = log.bufs;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+    if(superseded(tail))
+      continue;
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    if(recovering){
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    dbufs[n++] = dbuf;
+  }
+  bwrite_many(dbufs, n);  // write dsts to disk
+  for (tail = 0; tail < n; tail++) {
+    struct buf *dbuf = dbufs[tail];
     if(recovering == 0)
       bunpin(dbuf);
-    brelse(lbuf);
     brelse(dbuf);
   }
+  if(recovering == 0){
+    iost.installs++;
+    iost.homeblocks += n;
+  }
 }
 
 // Read the log header from disk into the in-memory log header
@@ -122,6 +182,50 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Whether the log should be installed once no FS system call
+// is running. Caller must hold log.lock.
+static int
+installdue(void)
+{
+  // a small log may have no room for another op at all.
+  return log.lh.n > log.cap/2 || log.lh.n + MAXOPBLOCKS > log.cap ||
+    (log.flushing && log.lh.n > 0);
+}
+
+// Whether the open transaction should be committed, or the log
+// installed, once no FS system call is running.
+// Caller must hold log.lock.
+static int
+commitdue(void)
+{
+  if(installdue())
+    return 1;
+  if(log.lh.n == log.committed)
+    return 0;
+  return LOGDELAY == 0 || log.syncing || ticks - log.opened >= LOGDELAY;
+}
+
+// Commit the open transaction, and install the log if due.
+// Caller must hold log.lock, and no FS system call may be
+// running.
+static void
+commit_locked(void)
+{
+  int install = installdue();
+
+  log.committing = 1;
+  log.syncing = 0;
+  log.flushing = 0;
+  release(&log.lock);
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit(install);
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
@@ -130,7 +234,10 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.outstanding == 0 && commitdue()){
+      // a delayed transaction is due, or in the way.
+      commit_locked();
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -142,19 +249,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless the commit can be delayed.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && commitdue()){
+    commit_locked();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,48 +267,97 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// Make the FS system calls that have ended so far durable.
+void
+log_sync(void)
+{
+  int want;
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+  acquire(&log.lock);
+  // a commit under way covers all of them, since no FS
+  // system call runs during a commit.
+  want = log.ncommit + (log.committing || log.lh.n > log.committed);
+  while(log.ncommit < want){
+    if(log.committing){
+      sleep(&log, &log.lock);
+    } else if(log.outstanding == 0){
+      commit_locked();
+    } else {
+      // the last end_op() will commit.
+      log.syncing = 1;
+      sleep(&log, &log.lock);
+    }
+  }
+  release(&log.lock);
+}
+
+// The writeback thread: every WBDELAY ticks, install what was
+// committed meanwhile, so that it does not wait in the cache for
+// the log to fill, and commit a transaction left open by end_op()
+// that no later end_op() came to commit once LOGDELAY was up.
+static void
+flusher(void)
+{
+  for(;;){
+    ticksleep(WBDELAY);
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    if(!log.committing){
+      if(log.committed > 0)
+        log.flushing = 1;
+      // else the last end_op() will.
+      if(log.outstanding == 0 && (log.flushing || commitdue()))
+        commit_locked();
+    }
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the blocks modified since the last commit from cache
+// to log.
 static void
 write_log(void)
 {
   int tail;
+  struct buf **tos = log.bufs;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = log.committed; tail < log.lh.n; tail++) {
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    tos[tail - log.committed] = to;
   }
+  bwrite_many(tos, log.lh.n - log.committed);  // write the log, in few requests
+  for (tail = 0; tail < log.lh.n - log.committed; tail++)
+    brelse(tos[tail]);
 }
 
 static void
-commit()
+commit(int install)
 {
-  if (log.lh.n > 0) {
+  int n = log.lh.n - log.committed;
+
+  if (n > 0) {
+    iost.commits++;
+    iost.logblocks += n;
+    if(n > iost.maxcommit)
+      iost.maxcommit = n;
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
+    log.committed = log.lh.n;
+  }
+  if (install && log.lh.n > 0) {
     install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.lh.n = log.committed = 0;
+    write_head();    // Erase the transactions from the log
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache by increasing refcnt.
+// Record the block number and pin in the cache by increasing refcnt,
+// once however many entries the block has.
 // commit()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
@@ -214,22 +368,27 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  int i, j;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
+  // the open transaction's entries; a committed copy stays.
+  for (i = log.committed; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorption
       break;
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
-    log.lh.n++;
+    for (j = 0; j < log.committed && log.lh.block[j] != b->blockno; j++)
+      ;
+    if (j == log.committed)
+      bpin(b);
+    if(log.lh.n++ == log.committed)
+      log.opened = ticks;
   }
   release(&log.lock);
 }
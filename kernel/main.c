@@ -17,6 +17,8 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    kmem_cache_init(); // slab allocator
+    dinit();         // dynamic memory heap
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -26,9 +28,16 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    rcuinit();       // deferred frees for lock-free readers
+    profinit();      // sampling profiler
+    traceinit();     // tracepoint rings
+    dcinit();        // directory name cache
+    textinit();      // shared program text
     fileinit();      // file table
-    virtio_disk_init(); // emulated hard disk
+    pipeinit();      // pipe cache
+    disk_init();     // emulated hard disk, or the image in memory
     userinit();      // first user process
+    reaperinit();    // frees exited processes' memory
     __sync_synchronize();
     started = 1;
   } else {
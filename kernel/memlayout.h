@@ -16,6 +16,7 @@
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
+// RAMDISK -- with MEMDISK, fs.img, loaded by qemu past PHYSTOP
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -45,9 +46,13 @@
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
 #define KERNBASE 0x80000000L
-#define HEAP_SIZE (16*1024*1024) // 16MB for the dynamic allocation heap
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// with the MEMDISK build option, qemu loads fs.img here, and
+// the kernel maps up to RAMDISKMAX bytes of it.
+#define RAMDISK PHYSTOP
+#define RAMDISKMAX (128*1024*1024)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -63,6 +68,19 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   VDSO (kernel data for user reads, see vdso.h)
+//   THREADFRAME(i) (p->trapframe of threads, see clone())
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// threads sharing a page table each need a trapframe of their
+// own; the one in process table slot i maps it here.
+#define THREADFRAME(i) (TRAPFRAME - ((i)+1)*PGSIZE)
+
+// the same read-only page in every process, below the thread
+// trapframes.
+#define VDSO (THREADFRAME(NPROC-1) - PGSIZE)
+
+// user memory ends below it.
+#define USERTOP VDSO
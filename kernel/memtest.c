@@ -1,14 +1,22 @@
 /*
  * memory allocation test
- * update time: 2024-4-15
+ * update time: 2026-10-14
  * author: feng
- * version: 1.4
+ * version: 2.1
  * update log:
  * v1.0 -- basic test
  * v1.1 -- boundary and random test
  * v1.2 -- stress test
  * v1.3 -- overwrite test
  * v1.4 -- more stressful stress test
+ * v1.5 -- report cycles per dalloc()/dfree() call
+ * v1.6 -- multi-hart stress test, run concurrently by several processes
+ * v1.7 -- benchmark mode: synthetic traces against dalloc and kalloc, with
+ *         throughput, latency percentiles, peak usage and fragmentation
+ * v1.8 -- realloc and aligned allocation tests
+ * v1.9 -- boundary test against DALLOCMAX, now that the heap grows
+ * v2.0 -- string benchmark: memmove/memset/memcmp against byte loops
+ * v2.1 -- functional tests no longer re-initialize the live heap
  */
 
 #include "types.h"
@@ -35,7 +43,7 @@ void basic_test() {
 void boundary_test() {
   printf("Entering boundary_test...\n");
   // Test Case 1: Allocate Very Large Memory
-  void *large_ptr = dalloc(HEAP_SIZE - 128);
+  void *large_ptr = dalloc(DALLOCMAX);
   if (large_ptr != 0) {
     printf("Allocated very large memory.\n");
     dfree(large_ptr);
@@ -45,8 +53,8 @@ void boundary_test() {
     return;
   }
 
-  // Test Case 2: Allocate Memory Exceeding Heap Size
-  void *exceed_ptr = dalloc(HEAP_SIZE);
+  // Test Case 2: Allocate More Than The Largest Block
+  void *exceed_ptr = dalloc(DALLOCMAX + 1);
   if (exceed_ptr == 0) {
     printf("Allocated memory exceeded heap size.\n");
   } else {
@@ -82,12 +90,20 @@ void srand(unsigned int seed) {
   next = seed;
 }
 
+// Print the average cost of n calls that took the given cycles.
+void report_cycles(const char *what, uint64 cycles, int n) {
+  if (n > 0) {
+    printf("%s: %d cycles/call\n", what, (int)(cycles / n));
+  }
+}
+
 void random_test() {
   printf("Entering random_test...\n");
 
   int passed = 0;
   int failed = 0;
   void *ptr_array[10] = {0}; // Array to store allocated addresses
+  uint64 alloc_cycles = 0, free_cycles = 0, t0;
 
   // Seed the pseudo-random number generator
   srand(1000);
@@ -96,7 +112,9 @@ void random_test() {
   for (int i = 0; i < 10; ++i) {
     // Generate random size for memory allocation (between 1 and 1000)
     unsigned size = (rand() % 100000) + 1;
+    t0 = r_cycle();
     void *ptr = dalloc(size);
+    alloc_cycles += r_cycle() - t0;
     if (ptr != 0) {
       printf("Allocated address: %p, size: %d\n", ptr, size);
       ptr_array[i] = ptr; // Store allocated address in array
@@ -110,11 +128,15 @@ void random_test() {
   // Free memory
   for (int i = 0; i < 10; ++i) {
     if (ptr_array[i] != 0) {
+      t0 = r_cycle();
       dfree(ptr_array[i]);
+      free_cycles += r_cycle() - t0;
       printf("Memory deallocated: %p\n", ptr_array[i]);
     }
   }
 
+  report_cycles("dalloc", alloc_cycles, 10);
+  report_cycles("dfree", free_cycles, passed);
   printf("Random test completed. Passed: %d, Failed: %d.\n\n", passed, failed);
 }
 
@@ -125,9 +147,11 @@ void stress_test() {
   int block_size = 65537; // 64KB + 1
   int passed = 0;
   int failed = 0;
+  uint64 alloc_cycles, free_cycles = 0, t0;
 
   // Allocate memory blocks
   void *ptrs[total_iterations];
+  t0 = r_cycle();
   for (int i = 0; i < total_iterations; ++i) {
     void *temp = dalloc(block_size);
     if (temp == 0) {
@@ -135,12 +159,15 @@ void stress_test() {
     }
     ptrs[i] = temp;
   }
+  alloc_cycles = r_cycle() - t0;
   printf("The last allocated address: %p\n", ptrs[total_iterations - 1]);
 
   // Free memory blocks
   for (int i = 0; i < total_iterations; ++i) {
     if (ptrs[i] != 0) {
+      t0 = r_cycle();
       dfree(ptrs[i]);
+      free_cycles += r_cycle() - t0;
       passed++;
       if (passed % 10 == 0) {
         printf("%d tests passed.\n", passed);
@@ -148,6 +175,8 @@ void stress_test() {
     }
   }
 
+  report_cycles("dalloc", alloc_cycles, total_iterations);
+  report_cycles("dfree", free_cycles, passed);
   printf("Stress test completed. \n%d allocations and deallocations attempted. \nPassed: %d, Failed: %d.\n\n", total_iterations, passed, failed);
 }
 
@@ -221,16 +250,373 @@ void overwrite_test() {
   }
 }
 
+void realloc_test() {
+  printf("Entering realloc_test...\n");
+
+  // Grow a block while its successor is free: it stays in place.
+  // (Blocks up to 256 bytes come from magazines, whose neighbours
+  // are not free.)
+  char *ptr = dalloc(1000);
+  if (ptr == 0) {
+    printf("Realloc test failed: unable to allocate memory.\n\n");
+    return;
+  }
+  for (int i = 0; i < 1000; ++i)
+    ptr[i] = i;
+  char *grown = drealloc(ptr, 4000);
+  if (grown != ptr) {
+    printf("Realloc test failed: block moved instead of growing in place.\n\n");
+    dfree(grown);
+    return;
+  }
+
+  // With a neighbour in the way, it has to move.
+  char *wall = dalloc(1000);
+  char *moved = drealloc(grown, 65536);
+  int ok = moved != 0;
+  for (int i = 0; ok && i < 1000; ++i)
+    ok = moved[i] == (char)i;
+  if (!ok) {
+    printf("Realloc test failed: data lost while moving.\n\n");
+  } else {
+    printf("Realloc test passed.\n\n");
+  }
+  if (wall)
+    dfree(wall);
+  if (moved)
+    dfree(moved);
+}
+
+void aligned_test() {
+  printf("Entering aligned_test...\n");
+
+  int failed = 0;
+  for (unsigned align = 32; align <= PGSIZE; align <<= 1) {
+    void *ptr = dalloc_aligned(100, align);
+    if (ptr == 0 || (uint64)ptr % align != 0) {
+      printf("Failed to allocate %d bytes aligned to %d.\n", 100, align);
+      failed++;
+    }
+    if (ptr)
+      dfree(ptr);
+  }
+  if (failed == 0) {
+    printf("Aligned test passed.\n\n");
+  } else {
+    printf("Aligned test failed.\n\n");
+  }
+}
+
+// Small-block churn meant to be run by several processes at once,
+// one per hart, to measure how dalloc/dfree scale with CPUS.
+// Works on the live heap, so it does not call dinit().
+int mp_stress_test() {
+  int rounds = 2000;
+  int batch = 16;
+  void *ptrs[batch];
+  int failed = 0;
+
+  uint64 t0 = r_time();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < batch; ++i) {
+      ptrs[i] = dalloc(16 + (i * 37) % 240);
+      if (ptrs[i] == 0) {
+        failed++;
+      }
+    }
+    for (int i = batch - 1; i >= 0; --i) {
+      if (ptrs[i] != 0) {
+        dfree(ptrs[i]);
+      }
+    }
+  }
+  uint64 elapsed = r_time() - t0;
+
+  printf("mp stress: %d dalloc/dfree pairs in %d time units, %d failed\n",
+         rounds * batch, (int)elapsed, failed);
+  return failed == 0 ? 0 : -1;
+}
+
+// Benchmark: each trace replays NBOPS allocations and frees,
+// with at most NBLIVE blocks live, against dalloc() and against
+// kalloc_pages(). Every call is timed with r_cycle(); the whole
+// run with r_time(), which ticks TIMEBASE times a second in qemu.
+#define NBOPS 4096
+#define NBLIVE 256
+#define TIMEBASE 10000000
+
+enum { UNIFORM, POWERLAW, PRODCONS, LIFETIME, NTRACES };
+static char *trace_names[NTRACES] = {
+  "uniform", "power-law", "producer/consumer", "long/short-lived"
+};
+
+struct allocator {
+  char *name;
+  void *(*alloc)(unsigned size);
+  void (*free)(void *ptr, unsigned size);
+  uint64 (*footprint)(unsigned size); // Memory a block of size takes.
+  void (*freeinfo)(uint64 *freebytes, uint64 *largest);
+};
+
+static void *bench_dalloc(unsigned size) { return dalloc(size); }
+static void bench_dfree(void *ptr, unsigned size) { dfree(ptr); }
+static uint64 dalloc_footprint(unsigned size) {
+  // data rounded up to 16 bytes, plus the header.
+  return ((size + 15) & ~15) + 16;
+}
+
+static int page_order(unsigned size) {
+  int order = 0;
+  while (((uint64)PGSIZE << order) < size)
+    order++;
+  return order;
+}
+static void *bench_kalloc(unsigned size) { return kalloc_pages(page_order(size)); }
+static void bench_kfree(void *ptr, unsigned size) { kfree_pages(ptr, page_order(size)); }
+static uint64 kalloc_footprint(unsigned size) { return (uint64)PGSIZE << page_order(size); }
+static void kalloc_freeinfo(uint64 *freebytes, uint64 *largest) {
+  *freebytes = (uint64)kfreepages() * PGSIZE;
+  *largest = (uint64)klargestfree() * PGSIZE;
+}
+
+static struct allocator allocators[] = {
+  { "dalloc", bench_dalloc, bench_dfree, dalloc_footprint, dheapinfo },
+  { "kalloc", bench_kalloc, bench_kfree, kalloc_footprint, kalloc_freeinfo },
+};
+
+// Shared by all runs, so only one benchmark may run at a time.
+static struct {
+  void *ptr;
+  unsigned size;
+  int longlived;
+} live[NBLIVE];
+static uint alloc_cycles[NBOPS], free_cycles[NBOPS];
+
+// Size of the next block a trace allocates.
+static unsigned trace_size(int trace) {
+  int k = 0;
+
+  switch (trace) {
+  case UNIFORM:
+    return 16 + rand() % 4081;
+  case POWERLAW:
+    // each doubling of the size is half as likely.
+    while (k < 10 && rand() % 2)
+      k++;
+    return (16 << k) + rand() % (16 << k);
+  case PRODCONS:
+    return 64 + rand() % 961;
+  default:
+    return 16 + rand() % 1009;
+  }
+}
+
+static void sort_cycles(uint *a, int n) {
+  for (int gap = n / 2; gap > 0; gap /= 2) {
+    for (int i = gap; i < n; i++) {
+      uint v = a[i];
+      int j;
+      for (j = i; j >= gap && a[j - gap] > v; j -= gap)
+        a[j] = a[j - gap];
+      a[j] = v;
+    }
+  }
+}
+
+static uint percentile(uint *a, int n, int pct) {
+  return n > 0 ? a[(n - 1) * pct / 100] : 0;
+}
+
+// Free live block i, timing the call.
+static void bench_free(struct allocator *a, int i, int *live_n, int *nfree) {
+  uint64 t0 = r_cycle();
+  a->free(live[i].ptr, live[i].size);
+  free_cycles[(*nfree)++] = r_cycle() - t0;
+  live[i] = live[--*live_n];
+}
+
+// Free the oldest live block, for the producer/consumer trace.
+static void bench_free_oldest(struct allocator *a, int *live_n, int *nfree) {
+  uint64 t0 = r_cycle();
+  a->free(live[0].ptr, live[0].size);
+  free_cycles[(*nfree)++] = r_cycle() - t0;
+  memmove(&live[0], &live[1], (--*live_n) * sizeof(live[0]));
+}
+
+static int bench_run(struct allocator *a, int trace) {
+  int live_n = 0, nlong = 0, nalloc = 0, nfree = 0, failed = 0;
+  uint64 used = 0, peak = 0, freebytes, largest, t0, start;
+
+  srand(trace + 1);
+  start = r_time();
+  for (int op = 0; op < NBOPS; op++) {
+    int doalloc = live_n == 0 || (live_n < NBLIVE && rand() % 2);
+    // long-lived blocks stay to the end; only short ones are freed.
+    if (!doalloc && trace == LIFETIME && nlong == live_n)
+      doalloc = live_n < NBLIVE;
+    if (doalloc) {
+      unsigned size = trace_size(trace);
+      t0 = r_cycle();
+      void *ptr = a->alloc(size);
+      alloc_cycles[nalloc++] = r_cycle() - t0;
+      if (ptr == 0) {
+        failed++;
+        continue;
+      }
+      live[live_n].ptr = ptr;
+      live[live_n].size = size;
+      live[live_n].longlived = trace == LIFETIME && nlong < NBLIVE / 2 && rand() % 8 == 0;
+      nlong += live[live_n].longlived;
+      live_n++;
+      used += a->footprint(size);
+      if (used > peak)
+        peak = used;
+    } else if (trace == PRODCONS) {
+      used -= a->footprint(live[0].size);
+      bench_free_oldest(a, &live_n, &nfree);
+    } else {
+      int i;
+      do {
+        i = rand() % live_n;
+      } while (trace == LIFETIME && live[i].longlived);
+      used -= a->footprint(live[i].size);
+      bench_free(a, i, &live_n, &nfree);
+    }
+  }
+  uint64 elapsed = r_time() - start;
+
+  // fragmentation with the long-lived blocks still in place.
+  a->freeinfo(&freebytes, &largest);
+  for (int i = 0; i < live_n; i++)
+    a->free(live[i].ptr, live[i].size);
+
+  sort_cycles(alloc_cycles, nalloc);
+  sort_cycles(free_cycles, nfree);
+  printf("%s %s: %d ops/s", a->name, trace_names[trace],
+         elapsed ? (int)((uint64)(nalloc + nfree) * TIMEBASE / elapsed) : 0);
+  printf(", alloc p50/p99 %d/%d cycles", percentile(alloc_cycles, nalloc, 50),
+         percentile(alloc_cycles, nalloc, 99));
+  printf(", free p50/p99 %d/%d cycles", percentile(free_cycles, nfree, 50),
+         percentile(free_cycles, nfree, 99));
+  printf(", peak %d KB", (int)(peak / 1024));
+  printf(", fragmentation %d%%", freebytes ? (int)(100 - largest * 100 / freebytes) : 0);
+  printf(", %d failed\n", failed);
+  return failed == 0 ? 0 : -1;
+}
+
+// Run every trace against every allocator, on the live heap.
+int bench_test() {
+  int r = 0;
+
+  for (int i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+    for (int t = 0; t < NTRACES; t++)
+      if (bench_run(&allocators[i], t) < 0)
+        r = -1;
+  return r;
+}
+
+// String benchmark: cycles per call of memmove(), memset() and
+// memcmp() against the byte-at-a-time loops they replaced, for
+// small copies and whole pages, aligned and not. The volatile
+// pointers keep the compiler from turning the loops back into
+// calls.
+#define NSOPS 2000
+
+static void byte_move(void *dst, const void *src, uint n) {
+  volatile char *d = dst;
+  const char *s = src;
+  while (n-- > 0)
+    *d++ = *s++;
+}
+static void word_move(void *dst, const void *src, uint n) { memmove(dst, src, n); }
+static void byte_set(void *dst, const void *src, uint n) {
+  volatile char *d = dst;
+  while (n-- > 0)
+    *d++ = 0x5a;
+}
+static void word_set(void *dst, const void *src, uint n) { memset(dst, 0x5a, n); }
+static volatile int cmp_sink;
+static void byte_cmp(void *dst, const void *src, uint n) {
+  volatile const uchar *s1 = dst, *s2 = src;
+  int r = 0;
+  while (n-- > 0)
+    if ((r = *s1++ - *s2++) != 0)
+      break;
+  cmp_sink = r;
+}
+static void word_cmp(void *dst, const void *src, uint n) { cmp_sink = memcmp(dst, src, n); }
+
+struct strop {
+  char *name;
+  void (*byte)(void *dst, const void *src, uint n);
+  void (*word)(void *dst, const void *src, uint n);
+};
+
+static struct strop strops[] = {
+  { "memmove", byte_move, word_move },
+  { "memset", byte_set, word_set },
+  { "memcmp", byte_cmp, word_cmp },
+};
+
+static uint64 string_time(void (*fn)(void *, const void *, uint), char *dst, char *src, uint n) {
+  uint64 t0 = r_cycle();
+  for (int i = 0; i < NSOPS; i++)
+    fn(dst, src, n);
+  return (r_cycle() - t0) / NSOPS;
+}
+
+int string_bench() {
+  static uint sizes[] = { 16, 64, 512, PGSIZE };
+  char *src = kalloc_pages(1), *dst = kalloc_pages(1);
+  uint64 tb, tw;
+
+  if (src == 0 || dst == 0) {
+    printf("string_bench: out of memory\n");
+    return -1;
+  }
+  memset(src, 0x5a, 2 * PGSIZE);
+  memset(dst, 0x5a, 2 * PGSIZE);
+  for (int i = 0; i < sizeof(strops) / sizeof(strops[0]); i++) {
+    for (int j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+      for (int off = 0; off < 2; off++) {
+        tb = string_time(strops[i].byte, dst, src + off, sizes[j]);
+        tw = string_time(strops[i].word, dst, src + off, sizes[j]);
+        printf("%s %d bytes%s: %d cycles, byte loop %d, %d.%dx\n",
+               strops[i].name, sizes[j], off ? " unaligned" : "", (int)tw, (int)tb,
+               (int)(tb / (tw ? tw : 1)), (int)(tb * 10 / (tw ? tw : 1) % 10));
+      }
+    }
+  }
+  kfree_pages(src, 1);
+  kfree_pages(dst, 1);
+  return 0;
+}
+
+// mode 0 runs the functional tests on the shared heap, which they
+// leave as they found it: other callers may be using it meanwhile;
+// mode 1 runs mp_stress_test() on the shared heap;
+// mode 2 runs the benchmarks on the shared heap;
+// mode 3 runs the string benchmark.
 int
-memtest(void)
+memtest(int mode)
 {
-  dinit();
+  if (mode == 1) {
+    return mp_stress_test();
+  }
+  if (mode == 2) {
+    return bench_test();
+  }
+  if (mode == 3) {
+    return string_bench();
+  }
 
   basic_test();
   boundary_test();
   random_test();
   stress_test();
   overwrite_test();
+  realloc_test();
+  aligned_test();
 
   return 0;
 }
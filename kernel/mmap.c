@@ -0,0 +1,233 @@
+/*
+ * memory-mapped files
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.1
+ * update log:
+ * v1.0 -- mmap() and munmap(), pages faulted in by uvmlazy(),
+ *         MAP_SHARED pages written back when unmapped
+ * v1.1 -- vmaread() locks the file with ilockfault()
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+/*
+ * Regions are placed top down from USERTOP, each below the
+ * lowest one so far, and growproc() keeps the heap under them.
+ * Page contents are copied from the buffer cache on the first
+ * touch, like demand-paged program segments; BSIZE is smaller
+ * than a page, so the cache's buffers cannot be mapped directly.
+ *
+ * The regions belong to one process, so a process with threads
+ * (a shared page table) cannot map files, and one with mapped
+ * files cannot create threads.
+ */
+
+// Lowest address used by mapped regions, USERTOP if none.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = USERTOP;
+
+  for(int i = 0; i < NVMA; i++)
+    if(p->vma[i].f && p->vma[i].va < base)
+      base = p->vma[i].va;
+  return base;
+}
+
+// The region of p that contains va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(v->f && va >= v->va && va - v->va < v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Read the page at va, which lies in region v, into mem.
+// Past the end of the file the page is left alone.
+// Returns 0 on success, -1 on failure.
+int
+vmaread(struct vma *v, char *mem, uint64 va)
+{
+  struct inode *ip = v->f->ip;
+  int r, locked;
+
+  if((locked = ilockfault(ip)) < 0)
+    return -1;
+  r = readi(ip, 0, (uint64)mem, v->off + (va - v->va), PGSIZE);
+  if(locked)
+    iunlock(ip);
+  return r < 0 ? -1 : 0;
+}
+
+// Map len bytes of f from offset off into the current process.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v = 0;
+  uint64 va;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(!f->readable || (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable))
+    return -1;
+  if(krefcnt(p->pagetable) > 1)
+    return -1;
+  for(int i = 0; i < NVMA; i++){
+    if(p->vma[i].f == 0){
+      v = &p->vma[i];
+      break;
+    }
+  }
+  if(v == 0)
+    return -1;
+
+  len = PGROUNDUP(len);
+  va = mmapbase(p);
+  if(len > va || va - len < PGROUNDUP(p->sz))
+    return -1;
+  va -= len;
+
+  v->va = va;
+  v->len = len;
+  v->off = off;
+  v->perm = ((prot & PROT_WRITE) ? PTE_W : 0) | ((prot & PROT_EXEC) ? PTE_X : 0);
+  v->flags = flags;
+  v->f = filedup(f);
+  return va;
+}
+
+// Write the stored-to pages of [va, va+len) of shared region v
+// back to its file, without growing the file.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  struct inode *ip = v->f->ip;
+  // a transaction's worth of blocks at a time, as in filewrite().
+  int max = ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
+  uint64 a, pa;
+  uint off, n, n1;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->va);
+    for(n = 0; n < PGSIZE; n += n1){
+      n1 = PGSIZE - n < max ? PGSIZE - n : max;
+      begin_op();
+      ilock(ip);
+      if(off + n >= ip->size){
+        iunlock(ip);
+        end_op();
+        break;
+      }
+      if(n1 > ip->size - (off + n))
+        n1 = ip->size - (off + n);
+      writei(ip, 0, pa + n, off + n, n1);
+      iunlock(ip);
+      end_op();
+    }
+  }
+}
+
+// Unmap [va, va+len) of region v of p, writing shared pages
+// back first, and drop the region once none of it is left.
+// The range must be at the start or the end of v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  if(v->flags == MAP_SHARED && (v->perm & PTE_W))
+    vmawriteback(p, v, va, len);
+  uvmunmap(p->pagetable, va, len / PGSIZE, 1);
+  if(va == v->va){
+    v->va += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->f = 0;
+  }
+}
+
+// Remove the mapping of [va, va+len) from the current process.
+// The range may not punch a hole in the middle of a region.
+// Returns 0 on success, -1 on failure.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(va % PGSIZE != 0 || len == 0 || (v = vmafind(p, va)) == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(va - v->va + len > v->len)
+    return -1;
+  if(va != v->va && va + len != v->va + v->len)
+    return -1;
+  vmaunmap(p, v, va, len);
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  for(int i = 0; i < NVMA; i++)
+    if(p->vma[i].f)
+      vmaunmap(p, &p->vma[i], p->vma[i].va, p->vma[i].len);
+}
+
+// Give fork()'s child np the regions of p. Touched pages of
+// shared regions are shared with the child, those of private
+// ones become copy-on-write. fork() holds np->lock, so no file
+// is closed here: references are only taken once all is mapped.
+// Returns 0 on success, -1 on failure with nothing mapped.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(v->f && uvmcopyrange(p->pagetable, np->pagetable, v->va, v->va + v->len,
+                            v->flags == MAP_SHARED) < 0)
+      goto bad;
+  }
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(p->vma[i].f)
+      filedup(p->vma[i].f);
+  }
+  return 0;
+
+ bad:
+  while(--i >= 0){
+    struct vma *v = &p->vma[i];
+    if(v->f)
+      uvmunmap(np->pagetable, v->va, v->len / PGSIZE, 1);
+  }
+  return -1;
+}
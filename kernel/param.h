@@ -1,13 +1,28 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process without a grown table
+#define NOFILEMAX  1024  // open files per process at most
+#define NINODE       50  // in-memory i-node entries at least
+#define NINODEMAX  1024  // in-memory i-node entries at most
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // max data blocks in on-disk log
+#define LOGDELAY      0  // ticks end_op() may leave a transaction uncommitted
+#define WBDELAY      30  // ticks committed blocks may wait to be written home
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS)  // disk block cache buffers at least
+#define NBUFMAX      2048  // disk block cache buffers at most
+#ifndef FSSIZE
+#define FSSIZE       4000  // size of file system in blocks, see Makefile
+#endif
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     11    // kalloc_pages() orders, up to 2^10 pages
+#define DCHUNKORDER  8     // dalloc() heap grows by 2^8 pages at least
+#define DALLOCMAX    ((4096L << (MAXORDER-1)) - 48) // largest dalloc() block
+#define NVMSEG        4    // demand-paged ELF segments per process
+#define NTEXTPAGE   256    // read-only program pages cached for sharing
+#define NSWAPSLOT  8192    // swap area pages used at most
+#define NVMA         16    // mmap() regions per process
+#define NPRIO         3    // scheduling levels, 0 is the highest
+#define TICKINTERVAL 1000000 // timer cycles per tick; about 1/10th second in qemu
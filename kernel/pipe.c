@@ -7,18 +7,31 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "buf.h"
 
-#define PIPESIZE 512
+// The ring is 2^PIPEORDER pages of its own, so that copies in
+// and out of it move whole runs of bytes at a time.
+#define PIPEORDER 0
+#define PIPESIZE (PGSIZE << PIPEORDER)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes from kalloc_pages()
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipe_cache;
+
+void
+pipeinit(void)
+{
+  if((pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), 0)) == 0)
+    panic("pipeinit");
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +41,9 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipe_cache)) == 0)
+    goto bad;
+  if((pi->data = kalloc_pages(PIPEORDER)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
@@ -46,8 +61,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree_pages(pi->data, PIPEORDER);
+    kmem_cache_free(pipe_cache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +86,20 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kfree_pages(pi->data, PIPEORDER);
+    kmem_cache_free(pipe_cache, pi);
   } else
     release(&pi->lock);
 }
 
+// Readers only sleep while the pipe is empty and writers while
+// it is full, so each side wakes the other only when it changes
+// that: a write into an empty pipe, a read from a full one.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
+  uint off;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -86,17 +109,23 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
     }
+    // the longest run that fits, up to the end of the ring.
+    off = pi->nwrite % PIPESIZE;
+    m = n - i;
+    if(m > PIPESIZE - (pi->nwrite - pi->nread))
+      m = PIPESIZE - (pi->nwrite - pi->nread);
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(copyin(pr->pagetable, &pi->data[off], addr + i, m) == -1)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
@@ -105,9 +134,9 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i = 0, m;
+  uint off;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +146,187 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(copyout(pr->pagetable, addr + i, &pi->data[off], m) == -1)
       break;
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    pi->nread += m;
+    i += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// splice() support: copies between the ring and a buffer
+// cache block, with neither a user buffer nor sleeping on
+// the pipe while the block is locked. pipewait() does the
+// sleeping beforehand, holding nothing else.
+
+// Wait until pi has room (write) or data (!write).
+// Returns 1 when it has, 0 at end of file (the write end is
+// closed and the ring empty), -1 if the read end is closed
+// or the caller was killed.
+int
+pipewait(struct pipe *pi, int write)
+{
+  struct proc *pr = myproc();
+  int r;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(killed(pr) || (write && pi->readopen == 0)){
+      r = -1;
+      break;
+    }
+    if(write && pi->nwrite != pi->nread + PIPESIZE){
+      r = 1;
+      break;
+    }
+    if(!write && pi->nread != pi->nwrite){
+      r = 1;
+      break;
+    }
+    if(!write && pi->writeopen == 0){
+      r = 0;
+      break;
+    }
+    sleep(write ? &pi->nwrite : &pi->nread, &pi->lock);
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Copy m bytes at src into the ring, or out of it to dst.
+// Caller must hold pi->lock and have checked the room.
+static void
+ringput(struct pipe *pi, char *src, int m)
+{
+  uint off = pi->nwrite % PIPESIZE;
+  int m1 = m < PIPESIZE - off ? m : PIPESIZE - off;
+
+  memmove(&pi->data[off], src, m1);
+  memmove(pi->data, src + m1, m - m1);
+  if(m > 0 && pi->nwrite == pi->nread)
+    wakeup(&pi->nread);
+  pi->nwrite += m;
+}
+
+static void
+ringget(struct pipe *pi, char *dst, int m)
+{
+  uint off = pi->nread % PIPESIZE;
+  int m1 = m < PIPESIZE - off ? m : PIPESIZE - off;
+
+  memmove(dst, &pi->data[off], m1);
+  memmove(dst + m1, pi->data, m - m1);
+  if(m > 0 && pi->nwrite == pi->nread + PIPESIZE)
+    wakeup(&pi->nwrite);
+  pi->nread += m;
+}
+
+// Move up to n bytes of ip from off into pi, as many as there
+// are room for, straight from the buffer cache, or from the
+// inode if its data is inline.
+// Returns the number of bytes moved, -1 if the read end is
+// closed. Caller must hold ip->lock.
+int
+pipefromi(struct pipe *pi, struct inode *ip, uint off, int n)
+{
+  struct buf *bp = 0;
+  uchar *data;
+  int tot, m;
+
+  if(off >= ip->size)
+    return 0;
+  if(n > ip->size - off)
+    n = ip->size - off;
+  for(tot = 0; tot < n; tot += m, off += m){
+    if(iinline(ip))
+      data = (uchar*)ip->addrs;
+    else if((bp = ibread(ip, off)) != 0)
+      data = bp->data;
+    else
+      break;
+    acquire(&pi->lock);
+    if(pi->readopen == 0){
+      release(&pi->lock);
+      if(bp)
+        brelse(bp);
+      return tot > 0 ? tot : -1;
+    }
+    m = n - tot;
+    if(m > BSIZE - off%BSIZE)
+      m = BSIZE - off%BSIZE;
+    if(m > PIPESIZE - (pi->nwrite - pi->nread))
+      m = PIPESIZE - (pi->nwrite - pi->nread);
+    ringput(pi, (char*)data + off%BSIZE, m);
+    release(&pi->lock);
+    if(bp)
+      brelse(bp);
+    ip->rapos = off + m;
+    if(m == 0)
+      break;
+  }
+  return tot;
+}
+
+// Move up to n bytes from pi, as many as it holds, into ip at
+// off, straight into the buffer cache, or into the inode if
+// its data stays inline, growing ip as writei() does.
+// Returns the number of bytes moved, or -1.
+// Caller must hold ip->lock, inside a transaction.
+int
+pipetoi(struct pipe *pi, struct inode *ip, uint off, int n)
+{
+  struct buf *bp = 0;
+  uchar *data;
+  int tot, m, inl, moved = 0;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+  idatawrite(ip);
+  inl = iinline(ip) && off + n <= NINLINE;
+  if(!inl && (moved = iexpand(ip, off + n)) < 0)
+    return -1;
+  for(tot = 0; tot < n; tot += m, off += m){
+    if(inl)
+      data = (uchar*)ip->addrs;
+    else if((bp = ibread(ip, off)) != 0)
+      data = bp->data;
+    else
+      break;
+    acquire(&pi->lock);
+    m = n - tot;
+    if(m > BSIZE - off%BSIZE)
+      m = BSIZE - off%BSIZE;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    ringget(pi, (char*)data + off%BSIZE, m);
+    release(&pi->lock);
+    if(bp){
+      if(m > 0)
+        log_write(bp);
+      brelse(bp);
+    }
+    if(m == 0)
+      break;
+  }
+  if(off > ip->size)
+    ip->size = off;
+  // bmap() may have added blocks to ip->addrs[]; the pipe may
+  // have held too little to outgrow them after iexpand().
+  if(!inl && moved && ip->size <= NINLINE)
+    ishrink(ip);
+  else
+    iupdate(ip);
+  return tot;
+}
@@ -16,6 +16,7 @@
 #include "proc.h"
 
 volatile int panicked = 0;
+volatile int panicking = 0; // output goes out synchronously
 
 // lock to avoid interleaving concurrent printf's.
 static struct {
@@ -119,6 +120,7 @@ void
 panic(char *s)
 {
   pr.locking = 0;
+  panicking = 1;
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -1,11 +1,22 @@
 /*
  * defines and functions of processes
- * update time: 2024-3-31
+ * update time: 2026-10-14
  * co-author: feng
- * version: 1.1
+ * version: 1.12
  * update log:
  * v1.0 -- original functions
  * v1.1 -- add getprocs function, to count the active processes
+ * v1.2 -- per-CPU run queues with stealing for scheduler()
+ * v1.3 -- hashed wait queues for sleep() and wakeup()
+ * v1.4 -- multi-level feedback queues, setpriority()
+ * v1.5 -- idle harts wfi with their timers parked
+ * v1.6 -- pid hash for kill(), active counter for getprocs()
+ * v1.7 -- clone() and join(), threads sharing a page table
+ * v1.8 -- per-process accounting, procstat()
+ * v1.9 -- kproc(), kernel threads for background work
+ * v1.10 -- setaffinity(), stealing only from long or stale queues
+ * v1.11 -- reaper thread frees exited processes' memory
+ * v1.12 -- kernel threads from allocslot(), uncounted and without user memory
  */
 
 #include "types.h"
@@ -15,6 +26,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
+#include "procstat.h"
+#include "vdso.h"
 
 struct cpu cpus[NCPU];
 
@@ -25,11 +39,93 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Processes by pid, from allocproc() until freeproc().
+// Lock order: p->lock, then pidhash_lock. Lookups by kill()
+// and setpriority() only read the chains, so they share it.
+#define NPIDHASH 64
+static struct proc *pidhash[NPIDHASH];
+static struct rwlock pidhash_lock;
+
+// Processes that are neither UNUSED nor ZOMBIE, for getprocs(),
+// counted in the vdso page where user programs read it.
+#define nactive (vdso->nactive)
+
+// Keeps p->sz the same in all threads sharing a page table.
+static struct spinlock grow_lock;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int forkfinish(struct proc *p, struct proc *np, int *fd);
+static int reap(int pid, uint64 addr);
+static void runqput(struct proc *p, int id);
+static struct proc *runqget(int id, int self);
+static struct proc *runqsteal(int self);
+static void idle(struct cpu *c);
 
 extern char trampoline[]; // trampoline.S
 
+// Per-CPU queues of RUNNABLE processes. A process goes on the
+// queue of the CPU it last ran on when it becomes RUNNABLE, and
+// comes off when a scheduler() picks it to run. A CPU whose queue
+// is empty steals from the busiest other queue, but only when it
+// holds STEALMIN processes or more, or one queued MIGRATEWAIT
+// timer cycles ago: a process soon run where it last ran finds
+// its cache and TLB warm. setaffinity() confines a process to
+// some CPUs, which no other CPU queues or steals it for.
+// Lock order: p->lock, then the queue's lock.
+//
+// Each queue is a multi-level feedback queue: one FIFO per
+// priority level, 0 first. A process that uses up the time slice
+// of its level, 2^level ticks, moves a level down; one that
+// sleeps before that moves a level up, but never above the base
+// level set by setpriority(). A process kept waiting STARVETICKS
+// by higher levels runs next, back at its base level.
+#define STARVETICKS 100
+#define STEALMIN 2
+#define MIGRATEWAIT (TICKINTERVAL / 10)
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;                       // Number of queued processes.
+};
+
+static struct runq runqs[NCPU];
+
+// Sleeping processes, hashed by wait channel, so that wakeup()
+// only looks at processes that might sleep on its channel.
+// Lock order: a queue's lock, then p->lock.
+#define NWAITQ 64
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+};
+
+static struct waitq waitqs[NWAITQ];
+
+static struct waitq*
+waitq(void *chan)
+{
+  // the top bits of a multiplicative hash mix in every bit
+  // of the address, neighbouring fields included.
+  return &waitqs[((uint64)chan * 0x9E3779B97F4A7C15UL) >> 58];
+}
+
+// Take p, which is SLEEPING, off its wait queue.
+// Caller must hold the queue's lock and p->lock.
+static void
+waitq_remove(struct waitq *wq, struct proc *p)
+{
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    wq->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -60,7 +156,13 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  initrwlock(&pidhash_lock, "pidhash");
+  initlock(&grow_lock, "grow");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -114,10 +216,10 @@ allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// and return with p->lock held, for kproc() and allocproc().
+// If there are no free procs, return 0.
 static struct proc*
-allocproc(void)
+allocslot(void)
 {
   struct proc *p;
 
@@ -134,21 +236,20 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
-
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
+  acquirewrite(&pidhash_lock);
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  releasewrite(&pidhash_lock);
+  p->priority = 0;
+  p->level = 0;
+  p->slice = 0;
+  // the slot's ASID may still tag entries of an old page table.
+  p->asid = kvmasid(p - proc);
+  p->tlbgen++;
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  p->kfn = 0;
+  p->affinity = ~0;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -159,17 +260,154 @@ found:
   return p;
 }
 
+// Allocate a user process: a slot from allocslot(), counted
+// by getprocs(), with a trapframe and an empty user page table.
+// Returns with p->lock held.
+// If there are no free procs, or a memory allocation fails, return 0;
+// *nomem, unless nomem is 0, then tells which.
+static struct proc*
+allocproc(int *nomem)
+{
+  struct proc *p;
+
+  if(nomem)
+    *nomem = 0;
+  if((p = allocslot()) == 0)
+    return 0;
+  __sync_fetch_and_add(&nactive, 1);
+
+  // Allocate a trapframe page.
+  p->tfva = TRAPFRAME;
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0)
+    goto nomem;
+
+  // An empty user page table.
+  p->pagetable = proc_pagetable(p);
+  if(p->pagetable == 0)
+    goto nomem;
+
+  return p;
+
+ nomem:
+  freeproc(p);
+  release(&p->lock);
+  if(nomem)
+    *nomem = 1;
+  return 0;
+}
+
+// Exited processes whose memory is left to the reaper thread,
+// so that wait() need not free it all before returning. A
+// corpse lives in the process's old trapframe page. freeproc()
+// pushes corpses without a lock, and reapnow() takes them all at
+// once, so a corpse cannot come back while one looks at it.
+struct corpse {
+  struct corpse *next;
+  pagetable_t pagetable;
+  uint64 sz;
+  uint64 tfva;
+};
+
+static struct corpse *corpses;
+static struct spinlock reaper_lock; // for sleep() and wakeup() only
+static int reaperup;
+
+// Free the memory of the corpses left so far, in the caller.
+// Also called when memory runs out, to not wait for the reaper.
+// Returns how many there were.
+int
+reapnow(void)
+{
+  struct corpse *c, *next;
+  int n = 0;
+
+  c = __sync_lock_test_and_set(&corpses, 0);
+  for(; c; c = next){
+    next = c->next;
+    proc_freepagetable(c->pagetable, c->sz, c->tfva);
+    kfree(c);
+    n++;
+  }
+  return n;
+}
+
+static void
+reaper(void)
+{
+  acquire(&reaper_lock);
+  for(;;){
+    while(*(struct corpse * volatile *)&corpses == 0)
+      sleep(&corpses, &reaper_lock);
+    release(&reaper_lock);
+    reapnow();
+    acquire(&reaper_lock);
+  }
+}
+
+// Start the reaper thread.
+void
+reaperinit(void)
+{
+  initlock(&reaper_lock, "reaper");
+  if(kproc("reaper", reaper) < 0)
+    panic("reaperinit");
+  reaperup = 1;
+}
+
+// Wake the reaper if freeproc() left it work. Must be called
+// without any p->lock.
+static void
+reaperkick(void)
+{
+  if(*(struct corpse * volatile *)&corpses == 0)
+    return;
+  acquire(&reaper_lock);
+  wakeup(&corpses);
+  release(&reaper_lock);
+}
+
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages, which may be left to the reaper.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+  struct corpse *c;
+
+  if(p->pid){
+    acquirewrite(&pidhash_lock);
+    for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+      if(*pp == p){
+        *pp = p->pidnext;
+        break;
+      }
+    }
+    releasewrite(&pidhash_lock);
+  }
+  // a process that never ran to exit() is still counted;
+  // kernel threads never are.
+  if(p->state != UNUSED && p->state != ZOMBIE && p->kfn == 0)
+    __sync_fetch_and_sub(&nactive, 1);
+  // a page table shared by threads stays theirs at once.
+  if(reaperup && p->trapframe && p->pagetable && krefcnt(p->pagetable) == 1){
+    c = (struct corpse*)p->trapframe;
+    c->pagetable = p->pagetable;
+    c->sz = p->sz;
+    c->tfva = p->tfva;
+    do
+      c->next = corpses;
+    while(!__sync_bool_compare_and_swap(&corpses, c->next, c));
+    p->trapframe = 0;
+    p->pagetable = 0;
+  }
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  fdfree(p);
+  arena_reset(&p->arena);
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p->pagetable, p->sz, p->tfva);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
@@ -178,6 +416,8 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->rticks = p->nvcsw = p->nivcsw = p->nsyscall = 0;
+  p->nread = p->nwrite = p->npages = 0;
   p->state = UNUSED;
 }
 
@@ -212,16 +452,29 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the vdso page, which user programs only read.
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. A page table shared by
+// threads only loses the trapframe mapped at tfva, until
+// the last of them frees it.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 sz, uint64 tfva)
 {
+  uvmunmap(pagetable, tfva, 1, 0);
+  if(krefdrop(pagetable))
+    return;
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -244,7 +497,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -255,70 +508,263 @@ userinit(void)
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
+  p->trapframe->tp = p->pid;  // for getpid()
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runqput(p, 0);
 
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kprocstart.
+static void
+kprocstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kproc returned");
+}
+
+// Start a kernel thread: a process that runs fn(), which must
+// not return, and never enters user space. It has no parent
+// and cannot be killed, has no trapframe or user page table,
+// and is not counted by getprocs().
+// Returns its pid, or -1.
+int
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocslot()) == 0)
+    return -1;
+  p->asid = 0;
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  runqput(p, cpuid());
+  release(&p->lock);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address space; each page is
+// allocated by uvmlazy() when it is first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *pp;
+  int shared;
 
+  acquire(&grow_lock);
   sz = p->sz;
+  shared = krefcnt(p->pagetable) > 1;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-      return -1;
-    }
+    if(sz + n > mmapbase(p))
+      goto bad;
+    sz += n;
   } else if(n < 0){
+    // other harts may still cache PTEs of a thread's page
+    // table (see uvmflush()), so threads never unmap memory.
+    if((uint64)-(long)n > sz || shared)
+      goto bad;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
+  for(pp = proc; shared && pp < &proc[NPROC]; pp++)
+    if(pp->pagetable == p->pagetable)
+      pp->sz = sz;
+  release(&grow_lock);
   return 0;
+
+ bad:
+  release(&grow_lock);
+  return -1;
 }
 
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
+// Fails while the page table is shared with threads.
+// Returns the child's pid, -1 on failure, or -2 if memory ran
+// out, when it may succeed after swapreclaim().
 int
 fork(void)
 {
-  int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  int nomem;
 
-  // Allocate process.
-  if((np = allocproc()) == 0){
+  // copy-on-write would change PTEs that sibling threads may
+  // hold in their TLBs on other harts, with no way to flush them.
+  if(krefcnt(p->pagetable) > 1)
     return -1;
+
+  // Allocate process.
+  if((np = allocproc(&nomem)) == 0){
+    return nomem ? -2 : -1;
   }
+  // the rest fails only for want of memory.
+  if(fdgrow(np, p->nofile) < 0)
+    goto nomem;
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
+    goto nomem;
+  np->sz = p->sz;
+  if(vmacopy(p, np) < 0)
+    goto nomem;
+
+  // copy saved user registers.
+  *(np->trapframe) = *(p->trapframe);
+
+  // Cause fork to return 0 in the child.
+  np->trapframe->a0 = 0;
+
+  return forkfinish(p, np, 0);
+
+ nomem:
+  freeproc(np);
+  release(&np->lock);
+  return -2;
+}
+
+// Create a thread: a process that shares the caller's page
+// table, and so its memory, and starts running fn(arg) on the
+// user stack that ends at stack. fn must not return, but call
+// exit(). Open files and the current directory are copied as
+// by fork().
+// Returns the thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // mapped files belong to a single process (see mmap.c).
+  if(mmapbase(p) != USERTOP)
+    return -1;
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  if(fdgrow(np, p->nofile) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  // Trade the fresh page table for the caller's, with the
+  // thread's trapframe mapped at a slot of its own.
+  proc_freepagetable(np->pagetable, 0, TRAPFRAME);
+  np->pagetable = 0;
+  np->tfva = THREADFRAME(np - proc);
+  if(uvmshare(p->pagetable, np->tfva, np->trapframe) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
+  acquire(&grow_lock);
+  np->pagetable = p->pagetable;
   np->sz = p->sz;
+  release(&grow_lock);
+
+  // uvmflush() keeps track of one process per ASID, so threads
+  // use none, and the trampoline flushes the TLB on every switch.
+  np->asid = 0;
+  p->asid = 0;
 
-  // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack & ~15UL;
+  // a return from fn faults.
+  np->trapframe->ra = ~0UL;
 
-  // Cause fork to return 0 in the child.
-  np->trapframe->a0 = 0;
+  return forkfinish(p, np, 0);
+}
+
+// Create a child that runs path with argv, as fork() and exec()
+// would, but load the program straight into the child's empty
+// page table instead of copying the caller's memory first. The
+// child's descriptors 0, 1 and 2 are the caller's fd[0], fd[1]
+// and fd[2], or closed where one is -1; it gets no others.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fd)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  int i, argc;
+
+  for(i = 0; i < 3; i++)
+    if(fd[i] != -1 && (fd[i] < 0 || fd[i] >= p->nofile || p->ofile[fd[i]] == 0))
+      return -1;
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+
+  // execproc() sleeps. np is USED and has no parent yet, so
+  // nothing else looks at it meanwhile.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  argc = execproc(np, path, argv);
+  acquire(&np->lock);
+  if(argc < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  return forkfinish(p, np, fd);
+}
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+// Finish creating np as a child of p for fork(), clone() and
+// spawn(), and make it RUNNABLE. fd is 0 to give np all of p's
+// open files and program segments, or spawn()'s three
+// descriptors.
+// Caller must hold np->lock, which is released.
+// Returns np's pid.
+static int
+forkfinish(struct proc *p, struct proc *np, int *fd)
+{
+  int i, pid;
+
+  if(fd){
+    for(i = 0; i < 3; i++)
+      if(fd[i] >= 0)
+        np->ofile[i] = filedup(p->ofile[fd[i]]);
+  } else {
+    // increment reference counts on open file descriptors.
+    for(i = 0; i < p->nofile; i++)
+      if(p->ofile[i])
+        np->ofile[i] = filedup(p->ofile[i]);
+    // pages of the program not touched yet are still unmapped.
+    for(i = 0; i < NVMSEG; i++){
+      np->seg[i] = p->seg[i];
+      if(p->seg[i].ip)
+        idup(p->seg[i].ip);
+    }
+  }
   np->cwd = idup(p->cwd);
 
-  safestrcpy(np->name, p->name, sizeof(p->name));
+  // spawn()'s child is named after its program by execproc().
+  if(fd == 0)
+    safestrcpy(np->name, p->name, sizeof(p->name));
+  np->trapframe->tp = np->pid; // for getpid() without a trap.
+
+  // the child starts at the parent's base level.
+  np->priority = p->priority;
+  np->affinity = p->affinity;
+  np->level = p->priority;
 
   pid = np->pid;
 
@@ -329,7 +775,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runqput(np, cpuid());
   release(&np->lock);
 
   return pid;
@@ -362,16 +808,18 @@ exit(int status)
     panic("init exiting");
 
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
+  for(int fd = 0; fd < p->nofile; fd++){
     if(p->ofile[fd]){
       struct file *f = p->ofile[fd];
       fileclose(f);
       p->ofile[fd] = 0;
     }
   }
+  munmapall(p);
 
   begin_op();
   iput(p->cwd);
+  vmsegput(p->seg);
   end_op();
   p->cwd = 0;
 
@@ -387,6 +835,7 @@ exit(int status)
 
   p->xstate = status;
   p->state = ZOMBIE;
+  __sync_fetch_and_sub(&nactive, 1);
 
   release(&wait_lock);
 
@@ -399,9 +848,29 @@ exit(int status)
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
+{
+  return reap(-1, addr);
+}
+
+// Wait for thread tid, a child made by clone(), to exit.
+// Returns tid, or -1 if it is not a child.
+int
+join(int tid)
+{
+  if(tid <= 0)
+    return -1;
+  return reap(tid, 0);
+}
+
+// Wait for the child process with the given pid to exit, or for
+// any child if pid is -1, and free it. Copies its exit status to
+// user address addr if addr is not 0.
+// Returns the child's pid, or -1 if there is no such child.
+static int
+reap(int pid, uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -410,7 +879,7 @@ wait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+      if(pp->parent == p && (pid < 0 || pp->pid == pid)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -427,6 +896,7 @@ wait(uint64 addr)
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          reaperkick();
           return pid;
         }
         release(&pp->lock);
@@ -456,29 +926,200 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    // no RCU reader survives into scheduler().
+    __sync_synchronize();
+    c->rcugen++;
+
+    if((p = runqget(id, id)) == 0 && (p = runqsteal(id)) == 0){
+      // Nothing to run: use the time to pre-zero a free page,
+      // or else wait for an interrupt.
+      if(!kzero_idle())
+        idle(c);
+      continue;
     }
+
+    // p is off the queues, so no other CPU can pick it. Its
+    // lock may still be held by the CPU that queued it, until
+    // that CPU has switched away from it.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && (p->affinity & (1 << id)) == 0){
+      // setaffinity() moved it off this CPU since it was queued.
+      runqput(p, id);
+    } else if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      if(ticks - p->queued >= STARVETICKS)
+        p->level = p->priority;
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
+  }
+}
+
+// Wait for an interrupt instead of spinning in scheduler(),
+// with the timer parked, until a device interrupt, a sleeper's
+// deadline, or runqput() poking this CPU because it has work.
+static void
+idle(struct cpu *c)
+{
+  int id = c - cpus;
+  int i, busy = 0;
+
+  intr_off();
+  c->idle = 1;
+  // pairs with the barrier in runqput(): either it sees the
+  // flag and pokes, or the queues below show its process.
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    busy |= *(volatile int*)&runqs[i].n;
+  if(!busy){
+    timerpark(id);
+    wfi();
+    timerresume(id);
   }
+  c->idle = 0;
+  intr_on();
+}
+
+// Whether CPU id has started scheduling.
+static int
+cpuup(int id)
+{
+  return *(volatile uint64*)&cpus[id].rcugen != 0;
+}
+
+// Make p RUNNABLE and put it on CPU id's run queue, or on that
+// of a CPU p may run on if not id.
+// If that CPU is idle, poke it; otherwise poke some idle CPU p
+// may run on, so that it can steal.
+// Caller must hold p->lock.
+static void
+runqput(struct proc *p, int id)
+{
+  struct runq *rq;
+  int l = p->level;
+
+  if((p->affinity & (1 << id)) == 0)
+    for(id = 0; id < NCPU - 1 && !((p->affinity & (1 << id)) && cpuup(id)); id++)
+      ;
+  rq = &runqs[id];
+  p->state = RUNNABLE;
+  p->queued = ticks;
+  p->enqueued = r_time();
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+  rq->n++;
+  release(&rq->lock);
+
+  __sync_synchronize();
+  if(!*(volatile int*)&cpus[id].idle){
+    for(id = 0; id < NCPU && !(*(volatile int*)&cpus[id].idle &&
+                               (p->affinity & (1 << id))); id++)
+      ;
+  }
+  if(id < NCPU && id != cpuid())
+    timerpoke(id);
+}
+
+// Whether CPU self may steal p off a queue of n processes.
+static int
+stealable(struct proc *p, int self, int n)
+{
+  if((p->affinity & (1 << self)) == 0)
+    return 0;
+  return n >= STEALMIN || r_time() - p->enqueued >= MIGRATEWAIT;
+}
+
+// Take the next process for CPU self to run off CPU id's run
+// queue: the first of the highest non-empty level, unless a
+// lower level has starved. Stealing, with self not id, passes
+// over the processes that are not stealable().
+// Returns 0 if there is none.
+static struct proc*
+runqget(int id, int self)
+{
+  struct runq *rq = &runqs[id];
+  struct proc *p, *prev, *bestprev = 0;
+  struct proc **pp, **bestpp = 0;
+  int l, best = -1, starved;
+
+  // peek without the lock, so idle CPUs polling the
+  // queues don't bounce the lock between them.
+  if(*(volatile int*)&rq->n == 0)
+    return 0;
+  acquire(&rq->lock);
+  for(l = 0; l < NPRIO; l++){
+    prev = 0;
+    for(pp = &rq->head[l]; (p = *pp) != 0; pp = &p->rqnext){
+      if(id == self || stealable(p, self, rq->n))
+        break;
+      prev = p;
+    }
+    if(p == 0)
+      continue;
+    if(best >= 0 && ticks - p->queued < STARVETICKS)
+      continue;
+    starved = best >= 0;
+    best = l;
+    bestpp = pp;
+    bestprev = prev;
+    if(starved)
+      break;
+  }
+  p = 0;
+  if(best >= 0){
+    p = *bestpp;
+    *bestpp = p->rqnext;
+    if(rq->tail[best] == p)
+      rq->tail[best] = bestprev;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Steal a process from the longest run queue of another CPU,
+// or if it has none to give, from any other.
+static struct proc*
+runqsteal(int self)
+{
+  struct proc *p;
+  int id, n, best = -1, most = 0;
+
+  for(id = 0; id < NCPU; id++){
+    if(id != self && (n = *(volatile int*)&runqs[id].n) > most){
+      most = n;
+      best = id;
+    }
+  }
+  if(best < 0)
+    return 0;
+  if((p = runqget(best, self)) != 0)
+    return p;
+  for(id = 0; id < NCPU; id++)
+    if(id != self && id != best && (p = runqget(id, self)) != 0)
+      return p;
+  return 0;
 }
 
 // Switch to scheduler.  Must hold only p->lock
@@ -503,6 +1144,11 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  TRACE(TR_SWITCH, p->pid, p->state);
+  if(p->state == SLEEPING)
+    p->nvcsw++;
+  else if(p->state == RUNNABLE)
+    p->nivcsw++;
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -514,11 +1160,39 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p, cpuid());
   sched();
   release(&p->lock);
 }
 
+// Called on a timer interrupt while a process runs. Charge the
+// tick to its time slice, and give up the CPU once the slice is
+// used up, moving a level down, or if a process of a higher
+// level is waiting on this CPU.
+void
+timeryield(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  int l, preempt;
+
+  acquire(&p->lock);
+  rq = &runqs[cpuid()];
+  preempt = ++p->slice >= (1 << p->level);
+  if(preempt){
+    p->slice = 0;
+    if(p->level < NPRIO - 1)
+      p->level++;
+  }
+  for(l = 0; !preempt && l < p->level; l++)
+    preempt = *(struct proc * volatile *)&rq->head[l] != 0;
+  if(preempt){
+    runqput(p, cpuid());
+    sched();
+  }
+  release(&p->lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -546,21 +1220,36 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold the wait queue's lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
+  // Blocking before the time slice ran out marks an
+  // interactive or I/O-bound process: move it up a level.
+  p->slice = 0;
+  if(p->level > p->priority)
+    p->level--;
+
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
-
+  p->wqprev = 0;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqprev = p;
+  wq->head = p;
+  release(&wq->lock);
+
+  // whoever woke us took us off the wait queue.
   sched();
 
   // Tidy up.
@@ -576,17 +1265,46 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = waitq(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next) {
+    next = p->wqnext;
+    if(p->chan == chan){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        waitq_remove(wq, p);
+        runqput(p, p->cpu);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
+}
+
+// Find the process with the given pid and return it with
+// p->lock held, or return 0.
+static struct proc*
+pidlookup(int pid)
+{
+  struct proc *p;
+
+  acquireread(&pidhash_lock);
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  releaseread(&pidhash_lock);
+  if(p == 0)
+    return 0;
+  // p->lock comes before pidhash_lock, so check that p is still
+  // the process we looked for once we hold it.
+  acquire(&p->lock);
+  if(p->pid != pid){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
 // Kill the process with the given pid.
@@ -597,20 +1315,81 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  if(p->kfn){
+    release(&p->lock);
+    return -1;
+  }
+  p->killed = 1;
+  // Wake process from sleep(). The wait queue's lock
+  // comes before p->lock, so look again once both are held.
+  while(p->pid == pid && p->state == SLEEPING){
+    void *chan = p->chan;
+    struct waitq *wq = waitq(chan);
+    release(&p->lock);
+    acquire(&wq->lock);
     acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
+    if(p->pid == pid && p->state == SLEEPING && p->chan == chan){
+      waitq_remove(wq, p);
+      runqput(p, p->cpu);
     }
+    release(&wq->lock);
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Confine process pid to the CPUs in mask, bit i for CPU i. It
+// moves off a CPU not in mask the next time it gives it up.
+// Returns the old mask, or -1 if mask holds no running CPU.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+  int old, i;
+
+  for(i = 0; i < NCPU && !((mask & (1 << i)) && cpuup(i)); i++)
+    ;
+  if(i == NCPU)
+    return -1;
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  if(p->state == ZOMBIE || p->kfn){
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  old = p->affinity & ((1 << NCPU) - 1);
+  p->affinity = mask;
+  release(&p->lock);
+  if(p == myproc() && (mask & (1 << p->cpu)) == 0)
+    yield();
+  return old;
+}
+
+// Set the base scheduling level of process pid, 0 being the
+// highest, and move it down to that level if it is above.
+// Returns the old base level, or -1 on error.
+int
+setpriority(int pid, int priority)
+{
+  struct proc *p;
+  int old;
+
+  if(priority < 0 || priority >= NPRIO)
+    return -1;
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  if(p->state == ZOMBIE){
+    release(&p->lock);
+    return -1;
+  }
+  old = p->priority;
+  p->priority = priority;
+  if(p->level < priority)
+    p->level = priority;
+  release(&p->lock);
+  return old;
 }
 
 void
@@ -696,19 +1475,40 @@ procdump(void)
 int
 getprocs(void)
 {
-  int count = 0;
-  struct proc *p;
+  // allocproc(), exit() and freeproc() keep the count up to date
+  return *(volatile int*)&nactive;
+}
+
+// Copy the accounting of up to n processes to the user array at
+// addr, one record each. Returns the number copied, or -1.
+int
+procstat(uint64 addr, int n)
+{
+  struct proc *me = myproc();
+  struct procstat st;
+  int got = 0;
 
-  // Loop through the process table
-  acquire(&wait_lock); // Ensure consistency with other operations on process table
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock); // Acquire process lock
-    if (p->state != UNUSED && p->state != ZOMBIE) {
-      count++; // Increment count for each active process
+  for(struct proc *p = proc; p < &proc[NPROC] && got < n; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED){
+      release(&p->lock);
+      continue;
     }
-    release(&p->lock); // Release process lock
+    st.pid = p->pid;
+    st.state = p->state;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    st.sz = p->sz;
+    st.rticks = p->rticks;
+    st.nvcsw = p->nvcsw;
+    st.nivcsw = p->nivcsw;
+    st.nsyscall = p->nsyscall;
+    st.nread = p->nread;
+    st.nwrite = p->nwrite;
+    st.npages = p->npages;
+    release(&p->lock);
+    if(copyout(me->pagetable, addr + got * sizeof(st), (char*)&st, sizeof(st)) < 0)
+      return -1;
+    got++;
   }
-  release(&wait_lock); // Release wait_lock
-
-  return count; // Return the count of active processes
-}
\ No newline at end of file
+  return got;
+}
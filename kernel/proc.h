@@ -24,6 +24,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint tlbgen[NPROC+1];       // p->tlbgen this hart's TLB is up to date with, by ASID.
+  int idle;                   // Waiting for an interrupt in idle().
+  uint64 rcugen;              // Passes through scheduler(), see rcu.c.
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +85,40 @@ struct trapframe {
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
+// An ELF segment of the running program. Its pages are read
+// from the program file on first touch (see uvmlazy()).
+struct vmseg {
+  struct inode *ip;            // Program file, or 0 if the slot is unused
+  uint64 va;                   // Page-aligned start address
+  uint64 filesz;               // Bytes backed by the file
+  uint64 memsz;                // Bytes in memory, the rest zero-filled
+  uint off;                    // File offset of va
+  int perm;                    // PTE permissions of the pages
+};
+
+// A file region mapped by mmap(). Its pages are read from the
+// file on first touch, like a program segment; those of a
+// MAP_SHARED region are written back when it is unmapped.
+struct vma {
+  struct file *f;              // Mapped file, or 0 if the slot is unused
+  uint64 va;                   // Page-aligned start address
+  uint64 len;                  // Length, a multiple of PGSIZE
+  uint off;                    // File offset of va
+  int perm;                    // PTE permissions of the pages
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+};
+
+// Scratch memory for one system call, freed all at once by
+// arena_reset() (see arena.c).
+struct arena {
+  void *cur;                   // Newest chunk, or 0 if none
+  uint64 off;                  // Bytes used of cur
+  uint64 last;                 // Offset of the latest allocation
+};
+
+#define ARENAORDER 1                    // Chunks of 2^ARENAORDER pages
+#define ARENAMAX ((PGSIZE << ARENAORDER) - 16) // Largest arena_alloc()
+
 struct proc {
   struct spinlock lock;
 
@@ -91,17 +128,53 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  struct proc *pidnext;        // Next in its pidhash chain, under pidhash_lock
+  int cpu;                     // CPU the process last ran on
+  struct proc *rqnext;         // Next on a run queue, under its lock
+  struct proc *wqprev;         // Neighbours on a wait queue, under its lock
+  struct proc *wqnext;
+  int priority;                // Base scheduling level, see setpriority()
+  int level;                   // Current run queue level, >= priority
+  int slice;                   // Ticks used of the time slice at level
+  int affinity;                // CPUs it may run on, bit i for CPU i
+  uint queued;                 // ticks when last put on a run queue
+  uint64 enqueued;             // r_time() then, for stealing
+  uint wakeat;                 // tick to wake up at, under tickslock
+  struct proc *tnext;          // Next on the timer queue, under tickslock
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes), same for all threads
+  pagetable_t pagetable;       // User page table, shared by threads
+  int asid;                    // Address-space ID of pagetable, 0 if none
+  uint tlbgen;                 // Bumped when TLB entries of asid go stale
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User address of trapframe, TRAPFRAME or THREADFRAME(i)
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  void (*kfn)(void);           // What a kernel thread runs, see kproc()
+  struct file **ofile;         // Open files, nofile slots
+  int nofile;                  // Size of ofile, see fdgrow()
+  struct file *ofile0[NOFILE]; // ofile until it grows
   struct inode *cwd;           // Current directory
+  struct vmseg seg[NVMSEG];    // Program segments not loaded eagerly
+  struct vma vma[NVMA];        // mmap()ed regions, above sz
   char name[16];               // Process name (debugging)
+  struct arena arena;          // System call scratch memory
+  int ilocks;                  // Inode locks held, see ilockfault()
+  int ifaulted;                // ilockfault() gave up since last cleared
+
+  // accounting for procstat(), counted by the process itself or
+  // by its CPU's timer interrupt, so without a lock.
+  uint64 rticks;               // Timer ticks while running
+  uint64 nvcsw;                // Voluntary switches, to sleep
+  uint64 nivcsw;               // Involuntary switches, preempted
+  uint64 nsyscall;             // System calls
+  uint64 nread;                // Disk blocks read
+  uint64 nwrite;               // Disk blocks written
+  uint64 npages;               // User pages allocated
 };
+
+extern struct proc proc[NPROC];
@@ -0,0 +1,14 @@
+// Accounting of one process, see procstat().
+struct procstat {
+  int pid;
+  int state;          // enum procstate in kernel/proc.h.
+  char name[16];
+  uint64 sz;          // Bytes of user memory.
+  uint64 rticks;      // Timer ticks it was running at.
+  uint64 nvcsw;       // Switches away to sleep.
+  uint64 nivcsw;      // Switches away while still runnable.
+  uint64 nsyscall;    // System calls made.
+  uint64 nread;       // Disk blocks read.
+  uint64 nwrite;      // Disk blocks written.
+  uint64 npages;      // User pages allocated.
+};
@@ -0,0 +1,128 @@
+/*
+ * sampling profiler: the interrupted pc at every timer interrupt
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- per-CPU sample rings, profstart(), profstop() and profread()
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+/*
+ * While profiling is on, usertrap() and kerneltrap() hand every
+ * timer interrupt's pc to profsample(), which appends it to its
+ * CPU's ring. A full ring drops the sample rather than block the
+ * trap; profread() drains the rings and profstop() reports how
+ * many were dropped. Each ring's lock is only ever contended by
+ * a reader.
+ */
+
+struct profring {
+  struct spinlock lock;
+  struct profsample buf[PROFNBUF];
+  uint head;                // Next to read.
+  uint tail;                // Next to write; tail - head samples.
+  uint dropped;             // Lost to a full ring.
+};
+
+struct {
+  int on;
+  struct profring ring[NCPU];
+} prof;
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&prof.ring[i].lock, "prof");
+}
+
+// Record a timer interrupt at pc. Interrupts are off.
+void
+profsample(uint64 pc, int user)
+{
+  struct profring *r;
+  struct proc *p;
+
+  if(!*(volatile int*)&prof.on)
+    return;
+  r = &prof.ring[cpuid()];
+  p = myproc();
+  acquire(&r->lock);
+  if(r->tail - r->head == PROFNBUF){
+    r->dropped++;
+  } else {
+    struct profsample *s = &r->buf[r->tail++ % PROFNBUF];
+    s->pc = pc;
+    s->pid = p ? p->pid : 0;
+    s->user = user;
+  }
+  release(&r->lock);
+}
+
+// Discard old samples and start taking new ones.
+void
+profstart(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    struct profring *r = &prof.ring[i];
+    acquire(&r->lock);
+    r->head = r->tail = r->dropped = 0;
+    release(&r->lock);
+  }
+  __sync_synchronize();
+  prof.on = 1;
+}
+
+// Stop sampling. Returns the number of samples dropped.
+int
+profstop(void)
+{
+  int n = 0;
+
+  prof.on = 0;
+  __sync_synchronize();
+  for(int i = 0; i < NCPU; i++){
+    struct profring *r = &prof.ring[i];
+    acquire(&r->lock);
+    n += r->dropped;
+    release(&r->lock);
+  }
+  return n;
+}
+
+// Move up to n samples to the user array at addr, oldest of each
+// CPU first. Returns the number moved, or -1.
+int
+profread(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct profsample s;
+  int got = 0;
+
+  for(int i = 0; i < NCPU && got < n; i++){
+    struct profring *r = &prof.ring[i];
+    for(;;){
+      acquire(&r->lock);
+      if(got == n || r->head == r->tail){
+        release(&r->lock);
+        break;
+      }
+      s = r->buf[r->head++ % PROFNBUF];
+      release(&r->lock);
+      // copyout() may fault, so not under the lock.
+      if(copyout(p->pagetable, addr + got * sizeof(s), (char*)&s, sizeof(s)) < 0)
+        return -1;
+      got++;
+    }
+  }
+  return got;
+}
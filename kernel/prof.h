@@ -0,0 +1,8 @@
+// A sample of the sampling profiler, see profread().
+#define PROFNBUF 1024 // Samples buffered per CPU.
+
+struct profsample {
+  uint64 pc;          // Interrupted program counter.
+  int pid;            // Process running, or 0 if the CPU was idle.
+  int user;           // 1 if pc is a user address.
+};
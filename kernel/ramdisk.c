@@ -1,5 +1,12 @@
 //
-// ramdisk that uses the disk image loaded by qemu -initrd fs.img
+// ramdisk that uses the disk image qemu loads at RAMDISK, for
+// the MEMDISK build option (see the Makefile).
+//
+// The buffer cache points its buffers straight at the image's
+// blocks (see blookup()), so a cached block is never copied:
+// reads find it valid and writes land in place. Only buffers
+// of their own, like swap's, are copied in and out. Transfers
+// finish before the calls return, and there are no interrupts.
 //
 
 #include "types.h"
@@ -11,35 +18,77 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+static uint nblocks;   // blocks in the image
 
 void
 ramdiskinit(void)
 {
+  struct superblock *sb = (struct superblock*)(RAMDISK + BSIZE);
+
+  if(sb->magic != FSMAGIC)
+    panic("ramdiskinit: no file system image");
+  nblocks = sb->size + sb->nswap;
+  if((uint64)nblocks * BSIZE > RAMDISKMAX)
+    panic("ramdiskinit: image too big");
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-ramdiskrw(struct buf *b)
+ramdiskintr(void)
 {
-  if(!holdingsleep(&b->lock))
-    panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
+}
 
-  if(b->blockno >= FSSIZE)
-    panic("ramdiskrw: blockno too big");
+// The image's copy of block blockno.
+uchar*
+ramdisk_block(uint blockno)
+{
+  if(blockno >= nblocks)
+    panic("ramdisk_block: blockno too big");
+  return (uchar*)RAMDISK + (uint64)blockno * BSIZE;
+}
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
+static void
+ramdisk_copy(struct buf *b, int write)
+{
+  uchar *addr = ramdisk_block(b->blockno);
 
-  if(b->flags & B_DIRTY){
-    // write
+  if(b->data == addr)
+    return;
+  if(write)
     memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
+  else
     memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+}
+
+// Read or write the n buffers in bs, like virtio_disk_rwv().
+void
+ramdisk_rwv(struct buf **bs, int n, int write)
+{
+  for(int i = 0; i < n; i++)
+    ramdisk_copy(bs[i], write);
+  __sync_fetch_and_add(&iost.dreq, 1);
+  __sync_fetch_and_add(&iost.dblocks, n);
+}
+
+void
+ramdisk_rw(struct buf *b, int write)
+{
+  ramdisk_rwv(&b, 1, write);
+}
+
+// Like virtio_disk_submit(), but done, calling b->done(b) for
+// each buffer, before it returns.
+void
+ramdisk_submit(struct buf **bs, int n, int write)
+{
+  struct buf *b;
+
+  ramdisk_rwv(bs, n, write);
+  for(int i = 0; i < n; i++){
+    b = bs[i];
+    void (*done)(struct buf*) = b->done;
+    b->done = 0;
+    done(b);
   }
 }
@@ -0,0 +1,111 @@
+/*
+ * read-copy-update: lock-free readers, frees deferred past them
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- rcureadlock() and rcucall(), grace periods from scheduler() passes
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+/*
+ * A reader brackets its walk of a shared structure with
+ * rcureadlock() and rcureadunlock(), takes no lock, and may
+ * not sleep in between. A writer, under its own lock, unlinks
+ * an object so that no new reader can find it, then hands it
+ * to rcucall(), whose callback frees it once every reader that
+ * might still hold it is done.
+ *
+ * Readers keep interrupts off, so a CPU that has gone through
+ * scheduler() since an object was unlinked, or is idle, has no
+ * reader left that saw it: a grace period is over once every
+ * CPU has done one or the other. clockintr() notices that, on
+ * whichever hart ticks first, and runs the callbacks.
+ */
+
+struct {
+  struct spinlock lock;
+  struct rcuhead *next;   // Queued since the current batch began.
+  struct rcuhead *batch;  // Waiting for the current grace period.
+  uint64 snap[NCPU];      // cpus[i].rcugen when the batch began.
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+}
+
+void
+rcureadlock(void)
+{
+  push_off();
+}
+
+void
+rcureadunlock(void)
+{
+  pop_off();
+}
+
+// Call fn(h) once the readers running now are all done.
+void
+rcucall(struct rcuhead *h, void (*fn)(struct rcuhead*))
+{
+  h->fn = fn;
+  acquire(&rcu.lock);
+  h->next = rcu.next;
+  rcu.next = h;
+  release(&rcu.lock);
+}
+
+// Has every CPU passed a quiescent state since the batch began?
+// A CPU that had not yet entered scheduler() runs no readers.
+// Caller must hold rcu.lock.
+static int
+graceover(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    struct cpu *c = &cpus[i];
+    if(rcu.snap[i] != 0 && *(volatile uint64*)&c->rcugen == rcu.snap[i] &&
+       !*(volatile int*)&c->idle)
+      return 0;
+  }
+  return 1;
+}
+
+// Run the callbacks whose grace period is over, and start the
+// next batch. Called by clockintr().
+void
+rcupoll(void)
+{
+  struct rcuhead *h, *done = 0;
+
+  if(*(struct rcuhead* volatile*)&rcu.batch == 0 &&
+     *(struct rcuhead* volatile*)&rcu.next == 0)
+    return;
+  acquire(&rcu.lock);
+  if(rcu.batch && graceover()){
+    done = rcu.batch;
+    rcu.batch = 0;
+  }
+  if(rcu.batch == 0 && rcu.next){
+    rcu.batch = rcu.next;
+    rcu.next = 0;
+    for(int i = 0; i < NCPU; i++)
+      rcu.snap[i] = *(volatile uint64*)&cpus[i].rcugen;
+  }
+  release(&rcu.lock);
+
+  while((h = done) != 0){
+    done = h->next;
+    h->fn(h);
+  }
+}
@@ -201,6 +201,13 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space ID in satp tags the TLB entries the page
+// table loads, so switching between ASIDs needs no flush.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -256,6 +263,14 @@ r_mcounteren()
   return x;
 }
 
+// wait for an interrupt; returns once one is pending in sie,
+// even with interrupts disabled in sstatus.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -265,6 +280,16 @@ r_time()
   return x;
 }
 
+// cycles executed by this hart; readable in supervisor
+// mode once start() has set mcounteren.
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -327,6 +352,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entry of one page in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -334,6 +373,7 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
+#define SUPERPGSIZE (1L << 21) // bytes per level-1 superpage
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
@@ -343,6 +383,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed, set by the hart on any access
+#define PTE_D (1L << 7) // dirty, set by the hart on a store
+#define PTE_COW (1L << 8) // RSW bit: copy-on-write page
+#define PTE_SWAP (1L << 9) // RSW bit: not valid, the page is in a swap slot
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,6 +395,13 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a PTE_SWAP PTE holds a swap slot where the physical page number goes.
+#define SLOT2PTE(s) (((uint64)(s)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
+
+// a valid PTE with any of R, W, X set is a leaf, even above level 0.
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -0,0 +1,206 @@
+/*
+ * slab allocator for fixed-size kernel objects
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- kmem_cache_create(), alloc() and free() on kalloc() pages
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define OBJ_ALIGN 8     // object alignment
+#define MAP_WORDS 4     // free bitmap words per slab
+#define MAX_OBJS (MAP_WORDS * 64)
+
+/*
+ * Header at the start of each slab page. The page holds objects
+ * of one cache after the header; bit i of freemap is set while
+ * object i is free.
+ */
+struct slab {
+  struct slab *prev;        // Neighbours in the cache's partial or full list.
+  struct slab *next;
+  struct kmem_cache *cache; // Cache the slab belongs to.
+  uint nfree;               // Number of free objects.
+  uint64 freemap[MAP_WORDS];
+};
+
+#define SLAB_HDRSIZE ((sizeof(struct slab) + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1))
+
+/*
+ * A cache of objects of one size. Slabs with at least one free
+ * object sit on the partial list, the others on the full list.
+ * Only one completely free slab is kept around; further empty
+ * slabs go back to kalloc().
+ */
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint objsize;             // Object size, rounded up to OBJ_ALIGN.
+  uint perslab;             // Objects per slab.
+  void (*ctor)(void*);      // Run on each object when its slab is created.
+  struct slab *partial;     // Slabs with free objects.
+  struct slab *full;        // Slabs without free objects.
+  int nempty;               // Completely free slabs on the partial list.
+};
+
+// Caches themselves are objects of this bootstrap cache.
+static struct kmem_cache cache_cache;
+
+static void
+cache_setup(struct kmem_cache *c, char *name, uint size, void (*ctor)(void*))
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->objsize = (size + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1);
+  if(c->objsize == 0 || c->objsize > PGSIZE - SLAB_HDRSIZE)
+    panic("kmem_cache_create: size");
+  c->perslab = (PGSIZE - SLAB_HDRSIZE) / c->objsize;
+  if(c->perslab > MAX_OBJS)
+    c->perslab = MAX_OBJS;
+  c->ctor = ctor;
+  c->partial = 0;
+  c->full = 0;
+  c->nempty = 0;
+}
+
+void
+kmem_cache_init(void)
+{
+  cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0);
+}
+
+static void
+slab_unlink(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slab_push(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static inline void*
+slab_obj(struct kmem_cache *c, struct slab *s, int i)
+{
+  return (char*)s + SLAB_HDRSIZE + i * c->objsize;
+}
+
+// Get a fresh slab page with every object free and constructed.
+// Called without c->lock, since constructors may take locks.
+static struct slab*
+slab_create(struct kmem_cache *c)
+{
+  struct slab *s;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->nfree = c->perslab;
+  memset(s->freemap, 0, sizeof(s->freemap));
+  for(i = 0; i < c->perslab; i++){
+    s->freemap[i / 64] |= 1L << (i % 64);
+    if(c->ctor)
+      c->ctor(slab_obj(c, s, i));
+  }
+  return s;
+}
+
+// Create a cache of objects that are size bytes long.
+// ctor, if non-zero, initializes each object once when its
+// slab is created; objects should be freed in that state.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  if((c = kmem_cache_alloc(&cache_cache)) == 0)
+    return 0;
+  cache_setup(c, name, size, ctor);
+  return c;
+}
+
+// Allocate one object from the cache.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab *s;
+  int i, w;
+
+  acquire(&c->lock);
+  if(c->partial == 0){
+    release(&c->lock);
+    if((s = slab_create(c)) == 0)
+      return 0;
+    acquire(&c->lock);
+    slab_push(&c->partial, s);
+    c->nempty++;
+  }
+
+  s = c->partial;
+  if(s->nfree == c->perslab)
+    c->nempty--;
+  for(w = 0; s->freemap[w] == 0; w++)
+    ;
+  for(i = 0; (s->freemap[w] & (1L << i)) == 0; i++)
+    ;
+  s->freemap[w] &= ~(1L << i);
+  if(--s->nfree == 0){
+    slab_unlink(&c->partial, s);
+    slab_push(&c->full, s);
+  }
+  release(&c->lock);
+
+  return slab_obj(c, s, w * 64 + i);
+}
+
+// Return an object to the cache it was allocated from.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  uint64 off = (char*)obj - (char*)s - SLAB_HDRSIZE;
+  int i = off / c->objsize;
+
+  if(s->cache != c || off % c->objsize != 0 || i >= c->perslab)
+    panic("kmem_cache_free: bad object");
+
+  acquire(&c->lock);
+  if(s->freemap[i / 64] & (1L << (i % 64)))
+    panic("kmem_cache_free: double free");
+  s->freemap[i / 64] |= 1L << (i % 64);
+  if(s->nfree++ == 0){
+    slab_unlink(&c->full, s);
+    slab_push(&c->partial, s);
+  }
+  if(s->nfree == c->perslab){
+    if(c->nempty > 0){
+      // Keep only one empty slab cached.
+      slab_unlink(&c->partial, s);
+      release(&c->lock);
+      kfree(s);
+      return;
+    }
+    c->nempty++;
+  }
+  release(&c->lock);
+}
@@ -30,6 +30,23 @@ acquiresleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Acquire lk if no one holds it, without sleeping.
+// Returns 1 if it was acquired, 0 if not.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
@@ -7,13 +7,64 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// Counters per lock name. Locks of one name, such as every
+// pipe's, share an entry; names past NLOCKSTAT go uncounted.
+// Entries are only added, under statlock, a bare flag since
+// initlock() cannot use a spinlock itself.
+static struct lockstat stats[NLOCKSTAT];
+static char *statname[NLOCKSTAT];
+static int nstats;
+static uint statlock;
+
+static struct lockstat*
+statfor(char *name)
+{
+  struct lockstat *s = 0;
+  int i;
+
+  while(__sync_lock_test_and_set(&statlock, 1) != 0)
+    ;
+  for(i = 0; i < nstats; i++){
+    if(statname[i] == name || strncmp(statname[i], name, sizeof(s->name)) == 0){
+      s = &stats[i];
+      break;
+    }
+  }
+  if(s == 0 && nstats < NLOCKSTAT){
+    s = &stats[nstats];
+    statname[nstats] = name;
+    safestrcpy(s->name, name, sizeof(s->name));
+    __sync_synchronize();
+    nstats++;
+  }
+  __sync_lock_release(&statlock);
+  return s;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->isticket = 0;
+  lk->next = 0;
+  lk->serving = 0;
   lk->cpu = 0;
+  lk->stat = statfor(name);
+}
+
+// Initialize a ticket lock: waiters get the lock in the order
+// they came, and spin reading serving rather than swapping the
+// lock word, so a contended lock is fair and its cache line is
+// not bounced by every waiter. Worth it for the hot global
+// locks; an uncontended ticket lock costs about the same.
+void
+initticket(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->isticket = 1;
 }
 
 // Acquire the lock.
@@ -21,16 +72,24 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(lk->isticket){
+    uint t = __sync_fetch_and_add(&lk->next, 1);
+    while(*(volatile uint*)&lk->serving != t)
+      spins++;
+  } else {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      spins++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -39,7 +98,17 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for holding() and debugging.
+  lk->locked = 1;
   lk->cpu = mycpu();
+  if(lk->stat){
+    // shared by locks of one name, so atomic.
+    __sync_fetch_and_add(&lk->stat->acquire, 1);
+    if(spins){
+      __sync_fetch_and_add(&lk->stat->contended, 1);
+      __sync_fetch_and_add(&lk->stat->spins, spins);
+    }
+    lk->t0 = r_cycle();
+  }
 }
 
 // Release the lock.
@@ -49,6 +118,12 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->stat){
+    uint64 hold = r_cycle() - lk->t0;
+    // racy, but only ever loses to another long hold.
+    if(hold > lk->stat->maxhold)
+      lk->stat->maxhold = hold;
+  }
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -67,6 +142,8 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+  if(lk->isticket)
+    __sync_fetch_and_add(&lk->serving, 1);
 
   pop_off();
 }
@@ -81,6 +158,79 @@ holding(struct spinlock *lk)
   return r;
 }
 
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->cnt = 0;
+  lk->wwait = 0;
+}
+
+// Acquire lk shared with other readers. Like acquire(), keeps
+// interrupts off until the matching releaseread().
+void
+acquireread(struct rwlock *lk)
+{
+  uint c;
+
+  push_off();
+  for(;;){
+    c = *(volatile uint*)&lk->cnt;
+    if((c & RWWRITER) == 0 && *(volatile uint*)&lk->wwait == 0 &&
+       __sync_bool_compare_and_swap(&lk->cnt, c, c + 1))
+      break;
+  }
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  __sync_synchronize();
+  if(__sync_fetch_and_sub(&lk->cnt, 1) == 0)
+    panic("releaseread");
+  pop_off();
+}
+
+// Acquire lk exclusively, once the readers holding it are done.
+void
+acquirewrite(struct rwlock *lk)
+{
+  push_off();
+  __sync_fetch_and_add(&lk->wwait, 1);
+  while(!__sync_bool_compare_and_swap(&lk->cnt, 0, RWWRITER))
+    ;
+  __sync_fetch_and_sub(&lk->wwait, 1);
+  __sync_synchronize();
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if(lk->cnt != RWWRITER)
+    panic("releasewrite");
+  __sync_synchronize();
+  __sync_lock_release(&lk->cnt);
+  pop_off();
+}
+
+// Copy the counters of up to n lock names to user address
+// addr, for the lockstat() system call.
+// Returns the number copied, or -1.
+int
+lockstats(uint64 addr, int n)
+{
+  int cnt = nstats;
+
+  if(n < 0)
+    return -1;
+  if(cnt > n)
+    cnt = n;
+  if(copyout(myproc()->pagetable, addr, (char*)stats, cnt * sizeof(stats[0])) < 0)
+    return -1;
+  return cnt;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -1,9 +1,30 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  char isticket;     // Granted in FIFO order? See initticket().
+  uint next;         // Ticket lock: next ticket to hand out.
+  uint serving;      // Ticket lock: ticket of the holder.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  struct lockstat *stat; // Counters shared by locks of this name.
+  uint64 t0;         // r_cycle() when acquired.
 };
 
+// Reader-writer spin lock: any number of readers, or one writer.
+// Waiting writers hold off new readers, so they do not starve.
+struct rwlock {
+  uint cnt;          // Readers holding it, or RWWRITER.
+  uint wwait;        // Writers waiting.
+  char *name;        // Name of lock.
+};
+
+#define RWWRITER 0x80000000
+
+// Link for a callback deferred by rcucall(), kept in the
+// object the callback frees.
+struct rcuhead {
+  struct rcuhead *next;
+  void (*fn)(struct rcuhead*);
+};
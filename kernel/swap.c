@@ -0,0 +1,272 @@
+/*
+ * swap: user pages evicted to the disk's swap area when memory runs out
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.1
+ * update log:
+ * v1.0 -- clock replacement on the PTE accessed bit, swapin() from uvmlazy()
+ * v1.1 -- swapreclaim() frees the reaper's corpses first
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "iostat.h"
+
+/*
+ * mkfs lays out a swap area of sb.nswap blocks after the file
+ * system, which the kernel reads and writes a page at a time,
+ * bypassing the buffer cache and the log. An evicted page's PTE
+ * keeps its flags but loses PTE_V, gains PTE_SWAP, and holds the
+ * slot number where the physical page number was; fork() shares
+ * the slot with the child, so slots are reference counted.
+ *
+ * swapout() picks the page to evict with the clock algorithm,
+ * its hand sweeping the user pages of the processes in turn.
+ * It only takes a page that no other hart may be using through
+ * its TLB: one of the caller, or of a process that is not
+ * running, whose page table is not shared with threads and
+ * whose page is mapped nowhere else. Holding p->lock keeps such
+ * a process from running while its PTE changes, and bumping its
+ * tlbgen makes it flush its stale TLB entries before it does.
+ * The page is copied to swap.b and freed before the disk write,
+ * under the sleeplock that also orders a later swapin().
+ */
+
+#define SWAPLOW 16      // free pages below which a failure is lack of memory
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+
+struct {
+  struct spinlock lock;     // protects ref, nfree, hint
+  uchar ref[NSWAPSLOT];     // PTEs holding each slot
+  int nslot;
+  int nfree;
+  int hint;                 // where to look for a free slot
+  uint start;               // first block of the swap area
+
+  struct sleeplock iolock;  // protects b and the clock hand
+  struct buf b[SLOTBLOCKS]; // the page being moved
+  int hproc;                // the hand: proc[] slot
+  uint64 hva;               //   and user address
+} swap;
+
+// Called by fsinit() with the super block.
+void
+swapinit(struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+  swap.nfree = swap.nslot;
+  iost.swapslots = swap.nslot;
+}
+
+static int
+slotalloc(void)
+{
+  int i, s = -1;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot && swap.nfree > 0; i++){
+    s = (swap.hint + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nfree--;
+      swap.hint = s + 1;
+      break;
+    }
+    s = -1;
+  }
+  release(&swap.lock);
+  if(s >= 0)
+    __sync_fetch_and_add(&iost.swapused, 1);
+  return s;
+}
+
+// Take another reference to the slot of swap PTE pte, for fork().
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(swap.ref[PTE2SLOT(pte)]++ == 255)
+    panic("swapdup");
+  release(&swap.lock);
+}
+
+// Drop a reference to the slot of swap PTE pte.
+void
+swapfree(pte_t pte)
+{
+  int last;
+
+  acquire(&swap.lock);
+  if(swap.ref[PTE2SLOT(pte)] == 0)
+    panic("swapfree");
+  last = --swap.ref[PTE2SLOT(pte)] == 0;
+  if(last)
+    swap.nfree++;
+  release(&swap.lock);
+  if(last)
+    __sync_fetch_and_sub(&iost.swapused, 1);
+}
+
+// Move swap.b to or from slot s. Caller holds swap.iolock.
+static void
+slotio(int s, int write)
+{
+  struct buf *bs[SLOTBLOCKS];
+
+  for(int i = 0; i < SLOTBLOCKS; i++){
+    swap.b[i].data = swap.b[i].space;
+    swap.b[i].dev = ROOTDEV;
+    swap.b[i].blockno = swap.start + s * SLOTBLOCKS + i;
+    bs[i] = &swap.b[i];
+  }
+  disk_rwv(bs, SLOTBLOCKS, write);
+}
+
+// Advance the clock hand over p's pages, from swap.hva to p->sz,
+// and evict the first one whose accessed bit is clear into
+// swap.b, clearing the bit of those passed over. Returns the
+// slot the page goes to, or -1 if the hand got to the end of p.
+static int
+evict(struct proc *p)
+{
+  pte_t *pte;
+  uint64 va, pa;
+  int s = -1, stale = 0;
+
+  acquire(&p->lock);
+  if(p->pagetable == 0 || krefcnt(p->pagetable) > 1 ||
+     (p != myproc() && p->state != RUNNABLE && p->state != SLEEPING)){
+    release(&p->lock);
+    return -1;
+  }
+  acquire(ptlock(p->pagetable));
+  for(va = swap.hva; va < p->sz; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+      continue;
+    stale = 1;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    if(krefcnt((void*)pa) != 1)
+      continue;
+    if((s = slotalloc()) < 0)
+      break;
+    for(int i = 0; i < SLOTBLOCKS; i++)
+      memmove(swap.b[i].data, (char*)pa + i * BSIZE, BSIZE);
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    kfree((void*)pa);
+    va += PGSIZE;
+    break;
+  }
+  swap.hva = va;
+  release(ptlock(p->pagetable));
+  if(stale){
+    if(p == myproc())
+      uvmflush(p->pagetable, 0, PGROUNDUP(p->sz) / PGSIZE);
+    else
+      p->tlbgen++;
+  }
+  release(&p->lock);
+  return s;
+}
+
+// Evict one user page to the swap area, with the clock hand
+// going round at most twice. May sleep.
+// Returns 0 if a page was freed, -1 if none could be.
+int
+swapout(void)
+{
+  int s = -1;
+
+  if(swap.nfree == 0)
+    return -1;
+  acquiresleep(&swap.iolock);
+  for(int n = 0; n <= 2 * NPROC && swap.nfree > 0; n++){
+    if((s = evict(&proc[swap.hproc])) >= 0)
+      break;
+    swap.hproc = (swap.hproc + 1) % NPROC;
+    swap.hva = 0;
+  }
+  if(s >= 0){
+    slotio(s, 1);
+    __sync_fetch_and_add(&iost.swapout, 1);
+  }
+  releasesleep(&swap.iolock);
+  return s >= 0 ? 0 : -1;
+}
+
+// An allocation failed. Free the memory of exited processes not
+// reaped yet or, if memory ran out, evict a page, so the caller
+// can retry. May sleep.
+// Returns 0 if a page was freed.
+int
+swapreclaim(void)
+{
+  // exited processes' pages first.
+  if(reapnow() > 0)
+    return 0;
+  if(kfreepages() >= SWAPLOW)
+    return -1;
+  return swapout();
+}
+
+// Read back the evicted page at va of pagetable, which belongs
+// to the current process. May sleep.
+// Returns 0 on success, -1 if out of memory.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem;
+
+  while((mem = kalloc()) == 0)
+    if(swapreclaim() < 0)
+      return -1;
+  acquiresleep(&swap.iolock);
+  acquire(ptlock(pagetable));
+  pte = walk(pagetable, va, 0);
+  old = pte ? *pte : 0;
+  release(ptlock(pagetable));
+  if((old & PTE_SWAP) == 0){
+    // another thread read it back meanwhile.
+    releasesleep(&swap.iolock);
+    kfree(mem);
+    return 0;
+  }
+  slotio(PTE2SLOT(old), 0);
+  for(int i = 0; i < SLOTBLOCKS; i++)
+    memmove(mem + i * BSIZE, swap.b[i].data, BSIZE);
+  acquire(ptlock(pagetable));
+  if(*pte != old){
+    // a thread unmapped it meanwhile, and dropped the slot.
+    release(ptlock(pagetable));
+    releasesleep(&swap.iolock);
+    kfree(mem);
+    return 0;
+  }
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V | PTE_A;
+  release(ptlock(pagetable));
+  releasesleep(&swap.iolock);
+  swapfree(old);
+  if(myproc())
+    myproc()->npages++;
+  __sync_fetch_and_add(&iost.swapin, 1);
+  uvmflush(pagetable, va, 1);
+  return 0;
+}
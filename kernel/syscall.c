@@ -6,6 +6,13 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "trace.h"
+#include "sysstat.h"
+
+// Counts and latency histograms of each system call, per CPU,
+// merged by sysstats(). A call is counted on the CPU it returns
+// on, with interrupts off, so without a lock.
+static struct sysstat sysstat[NCPU][NSYSSTAT];
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -103,6 +110,28 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_getprocs(void);
 extern uint64 sys_memtest(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_dstat(void);
+extern uint64 sys_profstart(void);
+extern uint64 sys_profstop(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_tracectl(void);
+extern uint64 sys_traceread(void);
+extern uint64 sys_procstat(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_setaffinity(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,8 +159,76 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_getprocs] sys_getprocs,
 [SYS_memtest] sys_memtest,
+[SYS_setpriority] sys_setpriority,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_fsync]   sys_fsync,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_splice]  sys_splice,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_ringenter] sys_ringenter,
+[SYS_lockstat] sys_lockstat,
+[SYS_dstat]   sys_dstat,
+[SYS_profstart] sys_profstart,
+[SYS_profstop] sys_profstop,
+[SYS_profread] sys_profread,
+[SYS_tracectl] sys_tracectl,
+[SYS_traceread] sys_traceread,
+[SYS_procstat] sys_procstat,
+[SYS_sysstat] sys_sysstat,
+[SYS_iostat]  sys_iostat,
+[SYS_spawn]   sys_spawn,
+[SYS_setaffinity] sys_setaffinity,
 };
 
+static void
+sysstat_add(int num, uint64 dt)
+{
+  struct sysstat *s;
+  int b;
+
+  if(num >= NSYSSTAT)
+    return;
+  for(b = 0; b < SYSSTAT_NBUCKET - 1 && (dt >> (b + 1)) != 0; b++)
+    ;
+  push_off();
+  s = &sysstat[cpuid()][num];
+  s->count++;
+  s->time += dt;
+  s->hist[b]++;
+  pop_off();
+}
+
+// Copy the counters of system calls 0 to n-1, summed over the
+// CPUs, to the user array at addr. Returns the number copied, or
+// -1.
+int
+sysstats(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct sysstat st;
+
+  if(n < 0)
+    return -1;
+  if(n > NSYSSTAT)
+    n = NSYSSTAT;
+  for(int num = 0; num < n; num++){
+    memset(&st, 0, sizeof(st));
+    for(int i = 0; i < NCPU; i++){
+      struct sysstat *s = &sysstat[i][num];
+      st.count += s->count;
+      st.time += s->time;
+      for(int b = 0; b < SYSSTAT_NBUCKET; b++)
+        st.hist[b] += s->hist[b];
+    }
+    if(copyout(p->pagetable, addr + num * sizeof(st), (char*)&st, sizeof(st)) < 0)
+      return -1;
+  }
+  return n;
+}
+
 void
 syscall(void)
 {
@@ -142,7 +239,12 @@ syscall(void)
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
+    uint64 t0 = r_time();
+    p->nsyscall++;
+    TRACE(TR_SYSENTER, num, 0);
     p->trapframe->a0 = syscalls[num]();
+    TRACE(TR_SYSEXIT, num, p->trapframe->a0);
+    sysstat_add(num, r_time() - t0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
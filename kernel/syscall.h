@@ -22,3 +22,25 @@
 #define SYS_close  21
 #define SYS_getprocs 22
 #define SYS_memtest 23
+#define SYS_setpriority 24
+#define SYS_clone  25
+#define SYS_join   26
+#define SYS_fsync  27
+#define SYS_mmap   28
+#define SYS_munmap 29
+#define SYS_splice 30
+#define SYS_readv  31
+#define SYS_writev 32
+#define SYS_ringenter 33
+#define SYS_lockstat 34
+#define SYS_dstat  35
+#define SYS_profstart 36
+#define SYS_profstop 37
+#define SYS_profread 38
+#define SYS_tracectl 39
+#define SYS_traceread 40
+#define SYS_procstat 41
+#define SYS_sysstat 42
+#define SYS_iostat 43
+#define SYS_spawn  44
+#define SYS_setaffinity 45
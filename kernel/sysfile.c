@@ -25,7 +25,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= myproc()->nofile || (f=myproc()->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -34,7 +34,8 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
+// Allocate a file descriptor for the given file, growing
+// the table if all its slots are in use.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
@@ -42,13 +43,16 @@ fdalloc(struct file *f)
   int fd;
   struct proc *p = myproc();
 
-  for(fd = 0; fd < NOFILE; fd++){
+  for(fd = 0; fd < p->nofile; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
       return fd;
     }
   }
-  return -1;
+  if(fdgrow(p, fd + 1) < 0)
+    return -1;
+  p->ofile[fd] = f;
+  return fd;
 }
 
 uint64
@@ -76,6 +80,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  uvmprefault(p, n);
   return fileread(f, p, n);
 }
 
@@ -90,10 +95,59 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  uvmprefault(p, n);
 
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array of readv() and writev() into iov, and
+// page in file-backed buffers as sys_read() does.
+static int
+argiov(struct iovec *iov, int *pcnt)
+{
+  uint64 uiov, tot = 0;
+  int cnt;
+
+  argaddr(1, &uiov);
+  argint(2, &cnt);
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, cnt * sizeof(struct iovec)) < 0)
+    return -1;
+  for(int i = 0; i < cnt; i++){
+    // the total is returned as an int.
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+    uvmprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+  }
+  *pcnt = cnt;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
 uint64
 sys_close(void)
 {
@@ -107,6 +161,21 @@ sys_close(void)
   return 0;
 }
 
+// Return once the changes to the file system made so far,
+// including fd's, are on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 uint64
 sys_fstat(void)
 {
@@ -222,6 +291,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp->dev, dp->inum, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,18 +371,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path for sys_open() and ringenter().
+// Returns the new file descriptor, or -1.
+static int
+openpath(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -370,6 +436,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -431,47 +509,74 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the user's array of MAXARG or fewer strings at uargv
+// into argv. The strings are packed into the arena, each
+// trimmed to its length once fetched; the caller resets it.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
-  uint64 uargv, uarg;
+  int i, n;
+  uint64 uarg;
+  struct arena *a = &myproc()->arena;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
-      break;
+      return 0;
     }
-    argv[i] = kalloc();
+    argv[i] = arena_alloc(a, PGSIZE);
     if(argv[i] == 0)
-      goto bad;
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
+    if((n = fetchstr(uarg, argv[i], PGSIZE)) < 0)
+      return -1;
+    arena_trim(a, argv[i], n + 1);
   }
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  arena_reset(&myproc()->arena);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fd): a child running path, with the
+// caller's descriptors fd[0..2] as its 0, 1 and 2.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufd;
+  int fd[3];
+  int ret = -1;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufd);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(copyin(myproc()->pagetable, (char*)fd, ufd, sizeof(fd)) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, fd);
+  arena_reset(&myproc()->arena);
+  return ret;
 }
 
 uint64
@@ -503,3 +608,100 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f;
+
+  // addr is only a hint, and ignored.
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(argfd(4, 0, &f) < 0 || off < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+// Run one entry of a ringenter() batch, returning its result.
+static int
+ringop(struct ringent *e)
+{
+  struct proc *p = myproc();
+  char path[MAXPATH];
+  struct file *f = 0;
+
+  if(e->op == RING_OPEN){
+    if(copyinstr(p->pagetable, path, e->addr, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->fd);
+  }
+  if(e->fd < 0 || e->fd >= p->nofile || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case RING_READ:
+    uvmprefault(e->addr, e->n);
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    uvmprefault(e->addr, e->n);
+    return filewrite(f, e->addr, e->n);
+  case RING_CLOSE:
+    p->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// Run n queued operations from the array at addr in order, one
+// system call for the lot, posting each result in its entry's
+// res. A failed entry does not stop the ones after it.
+// Returns the number of entries run, or -1 if addr is bad.
+uint64
+sys_ringenter(void)
+{
+  struct proc *p = myproc();
+  struct ringent e;
+  uint64 addr;
+  int n, i;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0 || n > RING_MAX)
+    return -1;
+  for(i = 0; i < n; i++, addr += sizeof(e)){
+    if(copyin(p->pagetable, (char*)&e, addr, sizeof(e)) < 0)
+      break;
+    e.res = ringop(&e);
+    if(copyout(p->pagetable, addr + ((char*)&e.res - (char*)&e),
+               (char*)&e.res, sizeof(e.res)) < 0)
+      break;
+  }
+  return i > 0 || n == 0 ? i : -1;
+}
@@ -24,7 +24,12 @@ sys_getpid(void)
 uint64
 sys_fork(void)
 {
-  return fork();
+  int pid;
+
+  // out of memory: evict pages to swap and try again.
+  while((pid = fork()) == -2 && swapreclaim() == 0)
+    ;
+  return pid < 0 ? -1 : pid;
 }
 
 uint64
@@ -32,6 +37,8 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
+  if(p)
+    uvmprefault(p, sizeof(int));
   return wait(p);
 }
 
@@ -52,20 +59,9 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return ticksleep(n);
 }
 
 uint64
@@ -99,5 +95,143 @@ sys_getprocs(void)
 uint64
 sys_memtest(void)
 {
-  return memtest();
-}
\ No newline at end of file
+  int mode;
+
+  argint(0, &mode);
+  return memtest(mode);
+}
+
+uint64
+sys_setpriority(void)
+{
+  int pid, priority;
+
+  argint(0, &pid);
+  argint(1, &priority);
+  return setpriority(pid, priority);
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+
+  argint(0, &tid);
+  return join(tid);
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return lockstats(addr, n);
+}
+
+uint64
+sys_dstat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return dstat(addr);
+}
+
+uint64
+sys_profstart(void)
+{
+  profstart();
+  return 0;
+}
+
+uint64
+sys_profstop(void)
+{
+  return profstop();
+}
+
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return profread(addr, n);
+}
+
+uint64
+sys_tracectl(void)
+{
+  int mask;
+
+  argint(0, &mask);
+  return tracectl(mask);
+}
+
+uint64
+sys_traceread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return traceread(addr, n);
+}
+
+uint64
+sys_procstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return procstat(addr, n);
+}
+
+uint64
+sys_sysstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return sysstats(addr, n);
+}
+
+uint64
+sys_iostat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return iostat(addr);
+}
@@ -0,0 +1,9 @@
+// Calls and latency of one system call, see sysstats().
+#define NSYSSTAT 64        // System call numbers counted.
+#define SYSSTAT_NBUCKET 24 // Latency buckets: < 2^(i+1) timer cycles.
+
+struct sysstat {
+  uint64 count;            // Calls that returned.
+  uint64 time;             // Timer cycles spent in them.
+  uint hist[SYSSTAT_NBUCKET];
+};
@@ -0,0 +1,134 @@
+/*
+ * shared text: read-only program pages cached by inode and offset
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.2
+ * update log:
+ * v1.0 -- textpage() for uvmlazy(), dropped on write, truncate or reuse
+ * v1.1 -- locks the file with ilockfault()
+ * v1.2 -- tells uvmlazy() whether the page is new, for its accounting
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+
+/*
+ * A page of a read-only program segment holds the same bytes in
+ * every process running the program, so uvmlazy() maps one copy
+ * into all of them. The cache keeps a reference to each page it
+ * holds, on top of those of the page tables mapping it, so a
+ * program run again soon after finds its text still in memory.
+ *
+ * Entries are keyed by the in-memory inode, which stays the same
+ * file for as long as its table entry is not reused, and by the
+ * file offset and length of the page. The table is direct
+ * mapped: an entry that collides replaces the one there. An
+ * inode's entries go when it is written or truncated, both under
+ * its lock, which textpage() also holds from reading a page to
+ * caching it, or when ievict() reuses the inode's table entry.
+ */
+
+struct textent {
+  struct inode *ip;   // 0 if the entry is free
+  uint off;           // file offset of the page
+  uint n;             // bytes of the page read from the file
+  char *pa;
+};
+
+struct {
+  struct spinlock lock;
+  struct textent ent[NTEXTPAGE];
+} text;
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+}
+
+static struct textent*
+textslot(struct inode *ip, uint off)
+{
+  return &text.ent[((uint64)ip / sizeof(*ip) + off / PGSIZE) % NTEXTPAGE];
+}
+
+// A page holding the part of read-only segment s at va, shared
+// with the other processes running the program. The caller gets
+// a reference of its own, and *fresh set to 1 if the page was
+// allocated and read just now. Returns 0 if memory ran out or
+// the file could not be read.
+char*
+textpage(struct vmseg *s, uint64 va, int *fresh)
+{
+  struct inode *ip = s->ip;
+  struct textent *e;
+  uint off = s->off + (va - s->va);
+  uint n;
+  char *mem, *old;
+  int locked;
+
+  n = s->filesz - (va - s->va) < PGSIZE ? s->filesz - (va - s->va) : PGSIZE;
+  if((locked = ilockfault(ip)) < 0)
+    return 0;
+  acquire(&text.lock);
+  e = textslot(ip, off);
+  if(e->ip == ip && e->off == off && e->n == n){
+    mem = e->pa;
+    krefinc(mem);
+    release(&text.lock);
+    goto out;
+  }
+  release(&text.lock);
+
+  if((mem = kalloc_zeroed()) == 0)
+    goto out;
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    mem = 0;
+    goto out;
+  }
+  *fresh = 1;
+  krefinc(mem);     // the cache's reference
+  acquire(&text.lock);
+  old = e->ip ? e->pa : 0;
+  e->ip = ip;
+  e->off = off;
+  e->n = n;
+  e->pa = mem;
+  ip->textcached = 1;
+  release(&text.lock);
+  if(old)
+    kfree(old);
+
+ out:
+  if(locked)
+    iunlock(ip);
+  return mem;
+}
+
+// Drop the cached pages of ip, because its contents change or
+// its table entry is reused. Page tables that map them keep
+// their own references.
+void
+textinval(struct inode *ip)
+{
+  struct textent *e;
+
+  acquire(&text.lock);
+  for(e = text.ent; e < &text.ent[NTEXTPAGE]; e++){
+    if(e->ip == ip){
+      kfree(e->pa);
+      e->ip = 0;
+    }
+  }
+  ip->textcached = 0;
+  release(&text.lock);
+}
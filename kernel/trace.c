@@ -0,0 +1,145 @@
+/*
+ * tracepoints: timestamped records of kernel events, per CPU
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- TRACE() points, lock-free per-CPU rings, tracectl() and traceread()
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+
+/*
+ * TRACE(ev, a, b) tests one bit of tracemask, so a disabled
+ * tracepoint costs a load and a branch. An enabled one writes a
+ * record to its CPU's ring with interrupts off, taking no lock:
+ * only that CPU writes the ring, and a record is filled in
+ * before head counts it. The ring overwrites its oldest records
+ * rather than drop new ones.
+ *
+ * traceread() copies records out from a reader cursor to head
+ * without stopping the writers. It checks head again after
+ * copying each record, and discards one the writer may have
+ * reached meanwhile; discarded and overwritten records show up
+ * as a TR_LOST record.
+ */
+
+uint tracemask;
+
+struct tracering {
+  uint64 head;              // Records ever written.
+  struct traceent buf[TRACENBUF];
+};
+
+struct {
+  struct sleeplock lock;    // Serializes readers.
+  struct tracering ring[NCPU];
+  uint64 rd[NCPU];          // Next record traceread() returns.
+} trace;
+
+void
+traceinit(void)
+{
+  initsleeplock(&trace.lock, "trace");
+}
+
+void
+traceevent(int ev, uint64 a, uint64 b)
+{
+  struct tracering *r;
+  struct traceent *e;
+  struct proc *p;
+
+  push_off();
+  r = &trace.ring[cpuid()];
+  p = mycpu()->proc;
+  e = &r->buf[r->head % TRACENBUF];
+  e->time = r_time();
+  e->event = ev;
+  e->cpu = cpuid();
+  e->pid = p ? p->pid : 0;
+  e->a = a;
+  e->b = b;
+  __sync_synchronize();
+  r->head++;
+  pop_off();
+}
+
+// Set the mask of events to record, and return the old one.
+// Records from before tracing was last off are discarded.
+int
+tracectl(int mask)
+{
+  int old;
+
+  acquiresleep(&trace.lock);
+  old = tracemask;
+  if(old == 0)
+    for(int i = 0; i < NCPU; i++)
+      trace.rd[i] = *(volatile uint64*)&trace.ring[i].head;
+  __sync_synchronize();
+  tracemask = mask;
+  releasesleep(&trace.lock);
+  return old;
+}
+
+static int
+putent(uint64 addr, int got, struct traceent *e)
+{
+  return copyout(myproc()->pagetable, addr + got * sizeof(*e), (char*)e, sizeof(*e));
+}
+
+// Copy up to n records to the user array at addr, each CPU's in
+// order. Returns the number copied, or -1.
+int
+traceread(uint64 addr, int n)
+{
+  struct traceent e;
+  uint64 h, lost;
+  int got = 0;
+
+  acquiresleep(&trace.lock);
+  for(int i = 0; i < NCPU && got < n; i++){
+    struct tracering *r = &trace.ring[i];
+    lost = 0;
+    h = *(volatile uint64*)&r->head;
+    if(h - trace.rd[i] > TRACENBUF){
+      lost = h - trace.rd[i] - TRACENBUF;
+      trace.rd[i] = h - TRACENBUF;
+    }
+    // leave room for the TR_LOST record.
+    for(; trace.rd[i] != h && got < n - 1; trace.rd[i]++){
+      e = r->buf[trace.rd[i] % TRACENBUF];
+      __sync_synchronize();
+      if(*(volatile uint64*)&r->head - trace.rd[i] >= TRACENBUF){
+        lost++;
+        continue;
+      }
+      if(putent(addr, got++, &e) < 0)
+        goto bad;
+    }
+    if(lost && got < n){
+      memset(&e, 0, sizeof(e));
+      e.time = r_time();
+      e.event = TR_LOST;
+      e.cpu = i;
+      e.a = lost;
+      if(putent(addr, got++, &e) < 0)
+        goto bad;
+    }
+  }
+  releasesleep(&trace.lock);
+  return got;
+
+ bad:
+  releasesleep(&trace.lock);
+  return -1;
+}
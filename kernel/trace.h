@@ -0,0 +1,24 @@
+// Kernel tracepoints, see trace.c. Bit 1 << event of the mask
+// passed to tracectl() turns an event on.
+#define TR_SYSENTER  0  // a: system call number.
+#define TR_SYSEXIT   1  // a: system call number, b: return value.
+#define TR_SWITCH    2  // a: pid giving up the CPU, b: its new state.
+#define TR_BHIT      3  // a: dev, b: blockno, found in the buffer cache.
+#define TR_BMISS     4  // a: dev, b: blockno, read from the disk.
+#define TR_DISKSUB   5  // a: first blockno, b: 1 if a write.
+#define TR_DISKDONE  6  // a: first blockno.
+#define TR_KALLOC    7  // a: order, b: physical address.
+#define TR_DALLOC    8  // a: size, b: address.
+#define TR_NEVENT    9
+#define TR_LOST      15 // a: records overwritten before traceread().
+
+#define TRACENBUF 512   // Records kept per CPU.
+
+struct traceent {
+  uint64 time;          // r_time() when recorded.
+  ushort event;
+  ushort cpu;
+  int pid;              // Process running, or 0.
+  uint64 a;
+  uint64 b;
+};
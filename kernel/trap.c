@@ -5,10 +5,24 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+// Mapped at VDSO in every process, so a page of its own.
+union {
+  struct vdso v;
+  char page[PGSIZE];
+} vdsopage __attribute__((aligned(PGSIZE)));
+struct vdso *vdso = &vdsopage.v;
+
+// Processes in ticksleep(), sorted by the tick to wake up at.
+static struct proc *timerq;
+
+// mtime at which ticks next advances.
+static uint64 nexttick;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -19,7 +33,8 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initticket(&tickslock, "time");
+  nexttick = r_time() + TICKINTERVAL;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -29,6 +44,30 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// Map the page at stval, reading it from the program file if
+// needed, or copy it if it is copy-on-write. Like a system call,
+// that may sleep, so interrupts are enabled once the trap
+// registers have been read.
+// Kills p if the address is bad.
+static void
+pagefault(struct proc *p)
+{
+  uint64 scause = r_scause();
+  uint64 va = r_stval();
+  int r;
+
+  intr_on();
+  for(int i = 0; (r = uvmfault(p->pagetable, va, scause)) < 0; i++){
+    // out of memory: evict pages to swap and try again.
+    if(r == -2 && i < 8 && swapreclaim() == 0)
+      continue;
+    printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+    printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+    setkilled(p);
+    break;
+  }
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -67,6 +106,11 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // first touch of a demand-paged program page or a lazily
+    // allocated heap page, a store to a copy-on-write page,
+    // or a bad access.
+    pagefault(p);
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -77,8 +121,11 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
-    yield();
+  if(which_dev == 2){
+    p->rticks++;
+    profsample(p->trapframe->epc, 1);
+    timeryield();
+  }
 
   usertrapret();
 }
@@ -102,10 +149,16 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next traps into the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  // they only change when fork() copied in the parent's, or
+  // the process moved to another hart.
+  struct trapframe *tf = p->trapframe;
+  if(tf->kernel_sp != p->kstack + PGSIZE){
+    tf->kernel_satp = r_satp();         // kernel page table
+    tf->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
+    tf->kernel_trap = (uint64)usertrap;
+  }
+  if(tf->kernel_hartid != r_tp())
+    tf->kernel_hartid = r_tp();         // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
@@ -119,14 +172,24 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
+  // flush the TLB entries of p's ASID if they went stale since
+  // this hart last ran p (see uvmflush()).
+  struct cpu *c = mycpu();
+  uint gen = p->tlbgen;
+  if(p->asid && c->tlbgen[p->asid] != gen){
+    sfence_vma_asid(p->asid);
+    c->tlbgen[p->asid] = gen;
+  }
+
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP_ASID(p->pagetable, p->asid);
 
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // switches to the user page table, restores user registers
+  // from the trapframe at p->tfva, and switches to user mode
+  // with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -150,9 +213,15 @@ kerneltrap()
     panic("kerneltrap");
   }
 
+  if(which_dev == 2){
+    if(myproc() != 0)
+      myproc()->rticks++;
+    profsample(sepc, 0);
+  }
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    timeryield();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,13 +229,100 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Advance ticks by the time that has passed, which is more than
+// one tick if this hart has been idle with its timer parked,
+// and wake the sleepers whose time has come.
 void
 clockintr()
 {
+  uint64 now = r_time();
+  struct proc *p;
+
+  acquire(&tickslock);
+  if(now >= nexttick){
+    ticks += (now - nexttick) / TICKINTERVAL + 1;
+    nexttick = now - (now - nexttick) % TICKINTERVAL + TICKINTERVAL;
+    vdso->ticks = ticks;
+  }
+  while((p = timerq) != 0 && (int)(ticks - p->wakeat) >= 0){
+    timerq = p->tnext;
+    p->tnext = 0;
+    wakeup(&p->wakeat);
+  }
+  release(&tickslock);
+  rcupoll();
+}
+
+// Sleep for n ticks. The process waits on its own channel on
+// timerq, so clockintr() wakes only sleepers that are due.
+// Returns -1 if the process was killed.
+int
+ticksleep(int n)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+  int r = 0;
+
+  if(n <= 0)
+    return 0;
+  acquire(&tickslock);
+  p->wakeat = ticks + n;
+  for(pp = &timerq; *pp && (int)((*pp)->wakeat - p->wakeat) <= 0; pp = &(*pp)->tnext)
+    ;
+  p->tnext = *pp;
+  *pp = p;
+  while((int)(ticks - p->wakeat) < 0){
+    if(killed(p)){
+      r = -1;
+      break;
+    }
+    sleep(&p->wakeat, &tickslock);
+  }
+  // still queued if killed.
+  for(pp = &timerq; *pp; pp = &(*pp)->tnext){
+    if(*pp == p){
+      *pp = p->tnext;
+      break;
+    }
+  }
+  release(&tickslock);
+  return r;
+}
+
+// Called by an idle hart before it waits for an interrupt: stop
+// its periodic tick, leaving the timer set only for the next
+// sleeper's deadline, if any.
+void
+timerpark(int id)
+{
+  uint64 when = ~0UL;
+  int n;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if(timerq){
+    n = timerq->wakeat - ticks;
+    when = nexttick + (n > 1 ? (uint64)(n - 1) * TICKINTERVAL : 0);
+  }
   release(&tickslock);
+  *(volatile uint64*)CLINT_MTIMECMP(id) = when;
+}
+
+// Restart the periodic tick of a hart that is no longer idle,
+// and catch ticks up with the time it slept through.
+void
+timerresume(int id)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(id) =
+    *(volatile uint64*)CLINT_MTIME + TICKINTERVAL;
+  clockintr();
+}
+
+// Interrupt an idle hart, which xv6 has no IPIs for: make its
+// timer fire now. timervec re-arms it a tick later as usual.
+void
+timerpoke(int id)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(id) = *(volatile uint64*)CLINT_MTIME;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -189,7 +345,7 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      disk_intr();
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -205,9 +361,9 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    // every hart keeps ticks going, since idle ones stop
+    // their timers.
+    clockintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
@@ -38,16 +38,19 @@
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
-// the transmit output buffer.
+// the transmit output buffer, shared by write() and kernel
+// printf(), which the transmit interrupt drains.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 4096
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
 
 extern volatile int panicked; // from printf.c
+extern volatile int panicking;
 
 void uartstart();
+static int uartsend();
 
 void
 uartinit(void)
@@ -77,29 +80,66 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
-// UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// add n characters to the output buffer, as many at a time as
+// fit, and tell the UART to start sending if it isn't already.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
-// by write().
-void
-uartputc(int c)
+// by write(). returns the number added, fewer
+// than n if the process was killed.
+int
+uartwrite(char *s, int n)
 {
+  int i = 0;
+
   acquire(&uart_tx_lock);
+  while(i < n){
+    if(panicked){
+      for(;;)
+        ;
+    }
+    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartstart() to open up space in the buffer.
+      if(killed(myproc()))
+        break;
+      sleep(&uart_tx_r, &uart_tx_lock);
+      continue;
+    }
+    for(; i < n && uart_tx_w != uart_tx_r + UART_TX_BUF_SIZE; i++)
+      uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = s[i];
+    uartstart();
+  }
+  release(&uart_tx_lock);
+  return i;
+}
 
-  if(panicked){
-    for(;;)
-      ;
+// add a character to the output buffer without sleeping,
+// for kernel printf() and echoing input. if the buffer
+// is full, spin until the UART takes the oldest one.
+// during a panic, send the buffer and c synchronously,
+// without the lock, which another CPU may hold.
+void
+uartputc_async(int c)
+{
+  if(panicking){
+    while(uart_tx_r != uart_tx_w)
+      uartputc_sync(uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+    uartputc_sync(c);
+    return;
   }
+
+  acquire(&uart_tx_lock);
   while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    uartsend();
   }
   uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
   uart_tx_w += 1;
-  uartstart();
+  // no wakeup() from here: printf() may be called holding
+  // a process's lock. the transmit interrupt does it.
+  uartsend();
   release(&uart_tx_lock);
 }
 
@@ -126,36 +166,47 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// while the UART is idle, and characters are waiting
+// in the transmit buffer, send them. returns the
+// number sent.
 // caller must hold uart_tx_lock.
-// called from both the top- and bottom-half.
-void
-uartstart()
+static int
+uartsend()
 {
+  int n = 0;
+
   while(1){
     if(uart_tx_w == uart_tx_r){
       // transmit buffer is empty.
-      return;
+      return n;
     }
     
     if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
       // the UART transmit holding register is full,
       // so we cannot give it another byte.
       // it will interrupt when it's ready for a new byte.
-      return;
+      return n;
     }
     
     int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
+    n++;
     
     WriteReg(THR, c);
   }
 }
 
+// send what the UART will take now, and wake a writer
+// that may be waiting for space in the buffer.
+// caller must hold uart_tx_lock.
+// called from both the top- and bottom-half.
+void
+uartstart()
+{
+  if(uartsend())
+    wakeup(&uart_tx_r);
+}
+
 // read one input character from the UART.
 // return -1 if none is waiting.
 int
@@ -0,0 +1,8 @@
+// The page every process has mapped read-only at VDSO, for
+// user programs to read without a system call. The kernel also
+// keeps each process's pid in its user tp register, which xv6's
+// user code does not otherwise use.
+struct vdso {
+  uint ticks;         // As returned by uptime().
+  int nactive;        // As returned by getprocs().
+};
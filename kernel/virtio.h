@@ -47,7 +47,11 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 64
+
+// most blocks in one request. qemu takes up to the queue
+// size minus 2 as the device's seg_max.
+#define VIRTIO_MAXSEG 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -58,6 +62,7 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr points at a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
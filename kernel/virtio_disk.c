@@ -15,6 +15,9 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "proc.h"
+#include "iostat.h"
+#include "trace.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -48,11 +51,18 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    uint64 start;  // r_time() when it was started.
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // with indirect descriptors, each request takes a single
+  // descriptor in the ring, which points at its own in here,
+  // so NUM requests can be in flight instead of NUM/3.
+  int indirect;
+  struct virtq_desc itab[NUM][VIRTIO_MAXSEG+2];
   
   struct spinlock vdisk_lock;
   
@@ -91,7 +101,7 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  disk.indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -196,12 +206,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,30 +221,58 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Queue one transfer of the n buffers in bs, which hold
+// consecutive blocks, to or from the disk, and return the
+// index of its first descriptor.
+// Caller must hold vdisk_lock; sleeps until descriptors are free.
+static int
+virtio_disk_start(struct buf **bs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  struct virtq_desc *d[VIRTIO_MAXSEG+2];
+  int head, idx[VIRTIO_MAXSEG+2];
+  int nd = n + 2;
+  struct proc *p;
+
+  if(n < 1 || n > VIRTIO_MAXSEG)
+    panic("virtio_disk_start");
+  TRACE(TR_DISKSUB, bs[0]->blockno, write);
+  if((p = myproc()) != 0){
+    if(write)
+      p->nwrite += n;
+    else
+      p->nread += n;
+  }
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
+  // a descriptor for type/reserved/sector, then descriptors for
+  // the data, then one for a 1-byte status result.
+
+  // allocate the descriptors, or one pointing at a table
+  // of them.
+  if(disk.indirect){
+    while((head = alloc_desc()) < 0)
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    for(int i = 0; i < nd; i++){
+      d[i] = &disk.itab[head][i];
+      idx[i] = i;   // next fields index the table
+    }
+  } else {
+    while(1){
+      if(alloc_descs(idx, nd) == 0) {
+        break;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    for(int i = 0; i < nd; i++)
+      d[i] = &disk.desc[idx[i]];
+    head = idx[0];
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,32 +281,49 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d[0]->addr = (uint64) buf0;
+  d[0]->len = sizeof(struct virtio_blk_req);
+  d[0]->flags = VRING_DESC_F_NEXT;
+  d[0]->next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    d[i]->addr = (uint64) bs[i-1]->data;
+    d[i]->len = BSIZE;
+    if(write)
+      d[i]->flags = 0; // device reads b->data
+    else
+      d[i]->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d[i]->flags |= VRING_DESC_F_NEXT;
+    d[i]->next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.info[head].status = 0xff; // device writes 0 on success
+  d[nd-1]->addr = (uint64) &disk.info[head].status;
+  d[nd-1]->len = 1;
+  d[nd-1]->flags = VRING_DESC_F_WRITE; // device writes the status
+  d[nd-1]->next = 0;
+
+  if(disk.indirect){
+    disk.desc[head].addr = (uint64) disk.itab[head];
+    disk.desc[head].len = nd * sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the struct bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    bs[i]->disk = 1;
+    bs[i]->qnext = i + 1 < n ? bs[i+1] : 0;
+  }
+  disk.info[head].b = bs[0];
+  disk.info[head].start = r_time();
+  iost.dreq++;
+  iost.dblocks += n;
+  if(++iost.dqueue > iost.dmaxqueue)
+    iost.dmaxqueue = iost.dqueue;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % NUM] = head;
 
   __sync_synchronize();
 
@@ -280,17 +334,53 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
+  return head;
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
+
+// Read or write the n buffers in bs, which must hold consecutive
+// blocks, as one request, and wait for it to finish.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int id;
+
+  acquire(&disk.vdisk_lock);
+
+  id = virtio_disk_start(bs, n, write);
+
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(bs[0]->disk == 1) {
+    sleep(bs[0], &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  disk.info[id].b = 0;
+  free_chain(id);
 
   release(&disk.vdisk_lock);
 }
 
+// Start reading or writing the n buffers in bs, which must hold
+// consecutive blocks, as one request, without waiting for the
+// disk. virtio_disk_intr() calls b->done(b) for each, which
+// must be set, when the transfer is finished. Many transfers
+// can be in flight.
+void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  for(int i = 0; i < n; i++)
+    if(bs[i]->done == 0 || bs[i]->blockno != bs[0]->blockno + i)
+      panic("virtio_disk_submit");
+  acquire(&disk.vdisk_lock);
+  virtio_disk_start(bs, n, write);
+  release(&disk.vdisk_lock);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +407,31 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    TRACE(TR_DISKDONE, b->blockno, 0);
+    uint64 dt = r_time() - disk.info[id].start;
+    iost.dtime += dt;
+    if(dt > iost.dmaxtime)
+      iost.dmaxtime = dt;
+    iost.dqueue--;
+    if(b->done){
+      // no one waits in virtio_disk_rw() to free the chain.
+      disk.info[id].b = 0;
+      free_chain(id);
+      while(b){
+        struct buf *next = b->qnext;
+        void (*done)(struct buf*) = b->done;
+        b->disk = 0;   // disk is done with buf
+        b->done = 0;
+        done(b);
+        b = next;
+      }
+    } else {
+      // virtio_disk_rwv() waits on the first buf only.
+      for(struct buf *nb = b->qnext; nb; nb = nb->qnext)
+        nb->disk = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
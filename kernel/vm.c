@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,18 +17,34 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static uint64 asidmax; // largest ASID the harts implement
+
+// Threads of one process share its page table (see clone()), so
+// adding or changing user PTEs, which any of them may do on a
+// fault, is serialized by a lock chosen by the page table's root.
+#define NPTLOCK 16
+static struct spinlock ptlocks[NPTLOCK];
+
+struct spinlock*
+ptlock(pagetable_t pagetable)
+{
+  return &ptlocks[((uint64)pagetable / PGSIZE) % NPTLOCK];
+}
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, so idle harts can reprogram their timers.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
@@ -37,8 +55,15 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses 2MB superpages from the first aligned address
+  // on, which covers the dalloc heap.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
+#if MEMDISK
+  // the file system image.
+  kvmmap(kpgtbl, RAMDISK, RAMDISK, RAMDISKMAX, PTE_R | PTE_W);
+#endif
+
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
@@ -54,6 +79,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  for(int i = 0; i < NPTLOCK; i++)
+    initlock(&ptlocks[i], "pagetable");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -66,10 +93,77 @@ kvminithart()
 
   w_satp(MAKE_SATP(kernel_pagetable));
 
+  // the ASID field reads back with only the implemented bits set.
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+  asidmax = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(MAKE_SATP(kernel_pagetable));
+
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Return the ASID for process table slot i. Each slot owns one
+// for good; the kernel page table uses ASID 0. Returns 0 if the
+// harts have too few ASIDs, in which case the trampoline
+// flushes the whole TLB on every switch.
+int
+kvmasid(int i)
+{
+  return i + 1 <= asidmax ? i + 1 : 0;
+}
+
+// Note that npages of mappings starting at va changed in
+// pagetable. PTE changes in the current process's page table
+// are flushed from this hart's TLB, and mark its ASID stale on the
+// other harts, which flush it the next time they return to the
+// process (see usertrapret()). Page tables not in use get a
+// fresh tlbgen before they are installed.
+void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+
+  if(p == 0 || p->pagetable != pagetable || p->asid == 0)
+    return;
+  push_off();
+  c = mycpu();
+  if(c->tlbgen[p->asid] == p->tlbgen){
+    if(npages > 16){
+      sfence_vma_asid(p->asid);
+    } else {
+      for(; npages > 0; npages--, va += PGSIZE)
+        sfence_vma_page(va, p->asid);
+    }
+    c->tlbgen[p->asid] = p->tlbgen + 1;
+  }
+  p->tlbgen++;
+  pop_off();
+}
+
+// Like walk(), but return the PTE at the given level, which
+// callers can make a leaf to map a superpage.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int level = 2; level > leaf; level--) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(leaf, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,24 +176,13 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE at level 1 maps a whole 2MB superpage; walk()
+// returns it for any va inside the superpage.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
-
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+  return walklevel(pagetable, va, alloc, 0);
 }
 
 // Look up a virtual address, return the physical address,
@@ -115,6 +198,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
 
   pte = walk(pagetable, va, 0);
+  if((pte == 0 || (*pte & PTE_V) == 0) && uvmlazy(pagetable, va) == 0)
+    pte = walk(pagetable, va, 0);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -125,6 +210,121 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Back va with a page if it lies below p->sz of the current
+// process but is not mapped yet: either a page of a program
+// segment left for demand paging by exec(), which is read from
+// the file, or a page of the lazily grown heap (see growproc()),
+// which is zero-filled. Above p->sz, va may lie in a region
+// mapped by mmap(), whose page is read from its file.
+// returns 0 on success, -2 if memory ran out, -1 otherwise.
+int
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct vmseg *s = 0;
+  struct vma *v = 0;
+  int perm = PTE_W, fresh = 0;
+  pte_t *pte;
+  char *mem;
+
+  if(p == 0 || p->pagetable != pagetable || va >= MAXVA)
+    return -1;
+  if(va >= p->sz && (v = vmafind(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  if(pte && (*pte & PTE_SWAP)){
+    if(!intr_get())
+      return -1;
+    return swapin(pagetable, va) < 0 ? -2 : 0;
+  }
+  for(int i = 0; v == 0 && i < NVMSEG; i++){
+    if(p->seg[i].ip && va >= p->seg[i].va &&
+       va - p->seg[i].va < p->seg[i].memsz){
+      s = &p->seg[i];
+      perm = s->perm;
+      break;
+    }
+  }
+  if(v)
+    perm = v->perm;
+  // reading the file sleeps, which is not allowed while the
+  // caller holds a spinlock; see uvmprefault().
+  if(((s && va - s->va < s->filesz) || v) && !intr_get())
+    return -1;
+  if(s && !(perm & PTE_W) && va - s->va < s->filesz){
+    // read-only program text, one copy for all that run it.
+    if((mem = textpage(s, va, &fresh)) == 0)
+      return -1;
+  } else {
+    while((mem = kalloc_zeroed()) == 0)
+      if(!intr_get() || swapreclaim() < 0)
+        return -2;
+    fresh = 1;
+    if((s && vmsegread(s, mem, va) < 0) || (v && vmaread(v, mem, va) < 0)){
+      kfree(mem);
+      return -1;
+    }
+  }
+  acquire(ptlock(pagetable));
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // another thread faulted the page in meanwhile.
+    release(ptlock(pagetable));
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|perm) != 0){
+    // no memory for a page-table page.
+    release(ptlock(pagetable));
+    kfree(mem);
+    return -2;
+  }
+  release(ptlock(pagetable));
+  p->npages += fresh;
+  // the TLB may hold the invalid PTE.
+  uvmflush(pagetable, va, 1);
+  return 0;
+}
+
+// Page in the pages of [lo, hi) that lie in [va, va+len).
+static void
+prefault(struct proc *p, uint64 va, uint64 len, uint64 lo, uint64 hi)
+{
+  uint64 a, start, end;
+  pte_t *pte;
+
+  start = va > lo ? va : lo;
+  end = va + len < hi ? va + len : hi;
+  if(va + len < va)
+    end = hi;
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      uvmlazy(p->pagetable, a);
+  }
+}
+
+// Page in the file-backed pages of [va, va+len) of the current
+// process, for system calls that copy to or from user memory
+// while holding a spinlock (pipes, the console, wait()).
+void
+uvmprefault(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  for(int i = 0; i < NVMSEG; i++){
+    struct vmseg *s = &p->seg[i];
+    if(s->ip)
+      prefault(p, va, len, s->va, s->va + s->filesz);
+  }
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(v->f)
+      prefault(p, va, len, v->va, v->va + v->len);
+  }
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -139,10 +339,13 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
+// Kernel mappings use a 2MB superpage wherever va and pa are
+// both aligned and the range covers it; user page tables keep
+// 4KB pages, which copy-on-write and lazy allocation rely on.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, n;
   pte_t *pte;
 
   if(size == 0)
@@ -151,21 +354,30 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((perm & PTE_U) == 0 && a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      pte = walklevel(pagetable, a, 1, 1);
+      n = SUPERPGSIZE;
+    } else {
+      pte = walk(pagetable, a, 1);
+      n = PGSIZE;
+    }
+    if(pte == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < n)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += n;
+    pa += n;
   }
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched by a lazily
+// grown process have no mapping and are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -178,9 +390,14 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if((*pte & PTE_V) == 0){
+      if((*pte & PTE_SWAP) && do_free){
+        swapfree(*pte);
+        *pte = 0;
+      }
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -189,6 +406,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  uvmflush(pagetable, va, npages);
 }
 
 // create an empty user page table.
@@ -197,10 +415,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,14 +431,14 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// The caller charges the pages to the process that owns pagetable.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -233,12 +450,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -296,42 +512,151 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table but not the physical
+// memory: writable pages become read-only
+// copy-on-write pages in both, and are copied
+// by uvmcow() on the first store.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Like uvmcopy(), for the pages of [start, end); if share is
+// set, writable pages stay writable and shared by both, as for
+// a MAP_SHARED region.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  acquire(ptlock(old));
+  for(i = start; i < end; i += PGSIZE){
+    // not yet touched (lazily grown): stays lazy in the child.
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if((*pte & PTE_V) == 0){
+      // evicted: the child shares the swap slot.
+      if((*pte & PTE_SWAP) && !share){
+        pte_t *npte = walk(new, i, 1);
+        if(npte == 0)
+          goto err;
+        *npte = *pte;
+        swapdup(*pte);
+      }
+      continue;
+    }
+    if((*pte & PTE_W) && !share)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    krefinc((void*)pa);
   }
+  release(ptlock(old));
+  // the parent's writable TLB entries are stale now.
+  uvmflush(old, start, (end - start) / PGSIZE);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  release(ptlock(old));
+  uvmflush(old, start, (i - start) / PGSIZE);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Give the page at va its own writable copy, if it is
+// a copy-on-write page. The last sharer reuses the page.
+// returns 0 on success, -1 if va is not a copy-on-write
+// user page, -2 if memory ran out.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  acquire(ptlock(pagetable));
+  if((pte = walk(pagetable, va, 0)) == 0 ||
+     (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW)){
+    release(ptlock(pagetable));
+    return -1;
+  }
+  pa = PTE2PA(*pte);
+
+  if(krefcnt((void*)pa) > 1){
+    if((mem = kalloc()) == 0){
+      release(ptlock(pagetable));
+      return -2;
+    }
+    if(myproc())
+      myproc()->npages++;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+    kfree((void*)pa);
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  release(ptlock(pagetable));
+  uvmflush(pagetable, va, 1);
+  return 0;
+}
+
+// Handle a user page fault at va of the given cause: copy a
+// copy-on-write page on a store, or fault in a demand-paged one.
+// A thread may also fault on a page that another thread sharing
+// its page table has just mapped or made writable, while this
+// hart still caches the old PTE; flushing the TLB is enough then.
+// returns 0 if the access can be retried, -1 if it is bad,
+// -2 if memory ran out, when it may succeed after swapreclaim().
+int
+uvmfault(pagetable_t pagetable, uint64 va, uint64 scause)
+{
+  int need = scause == 12 ? PTE_X : scause == 13 ? PTE_R : PTE_W;
+  pte_t *pte;
+  int r;
+
+  if(va >= MAXVA)
+    return -1;
+  if(scause == 15 && (r = uvmcow(pagetable, va)) != -1)
+    return r;
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & (PTE_V | PTE_U | need)) == (PTE_V | PTE_U | need)){
+    // a hart that leaves the accessed and dirty bits to software
+    // faults when they are clear (see swapout()).
+    *pte |= PTE_A | (need == PTE_W ? PTE_D : 0);
+    sfence_vma();
+    return 0;
+  }
+  return uvmlazy(pagetable, va);
+}
+
+// Share pagetable with a new thread, whose trapframe tf is
+// mapped at va. proc_freepagetable() drops the share again.
+// returns 0 on success, -1 on failure.
+int
+uvmshare(pagetable_t pagetable, uint64 va, void *tf)
+{
+  int r;
+
+  acquire(ptlock(pagetable));
+  r = mappages(pagetable, va, PGSIZE, (uint64)tf, PTE_R | PTE_W);
+  release(ptlock(pagetable));
+  if(r < 0)
+    return -1;
+  krefinc(pagetable);
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -343,6 +668,56 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvmflush(pagetable, va, 1);
+}
+
+// The leaf page-table page found by the last lookup of a copy,
+// so that a copy spanning many pages walks the page table only
+// once per 2MB of user memory.
+struct walkcache {
+  pagetable_t pagetable;
+  uint64 base;        // first va the leaf maps
+  pagetable_t leaf;   // 0 until the first lookup
+};
+
+static pte_t *
+walkcached(struct walkcache *wc, uint64 va)
+{
+  pte_t *pte;
+
+  if(wc->leaf && va - wc->base < SUPERPGSIZE)
+    return &wc->leaf[PX(0, va)];
+  if((pte = walk(wc->pagetable, va, 0)) == 0)
+    return 0;
+  wc->base = va & ~(SUPERPGSIZE - 1);
+  wc->leaf = (pagetable_t)PGROUNDDOWN((uint64)pte);
+  return pte;
+}
+
+// Return the physical address of user page va0 for a copy,
+// faulting it in if needed, or 0 if it is not accessible.
+// For a store, also un-share a copy-on-write page, and
+// refuse a read-only one.
+static uint64
+copypage(struct walkcache *wc, uint64 va0, int store)
+{
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  pte = walkcached(wc, va0);
+  if((pte == 0 || (*pte & PTE_V) == 0) && uvmlazy(wc->pagetable, va0) == 0)
+    pte = walkcached(wc, va0);
+  if(pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+    return 0;
+  if(store){
+    // never store into a shared or read-only page.
+    if((*pte & PTE_COW) && uvmcow(wc->pagetable, va0) < 0)
+      return 0;
+    if((*pte & PTE_W) == 0)
+      return 0;
+  }
+  return PTE2PA(*pte);
 }
 
 // Copy from kernel to user.
@@ -352,10 +727,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct walkcache wc = { pagetable, 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = copypage(&wc, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -377,10 +753,11 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct walkcache wc = { pagetable, 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = copypage(&wc, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -395,6 +772,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// true if any byte of the word x is zero.
+#define HASZERO(x) (((x) - 0x0101010101010101UL) & ~(x) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -404,10 +784,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct walkcache wc = { pagetable, 0, 0 };
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = copypage(&wc, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -416,6 +797,19 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
     char *p = (char *) (pa0 + (srcva - va0));
     while(n > 0){
+      // copy whole words while both sides are aligned and
+      // no '\0' is in sight.
+      if((((uint64)p | (uint64)dst) & 7) == 0){
+        while(n >= 8 && !HASZERO(*(uint64*)p)){
+          *(uint64*)dst = *(uint64*)p;
+          n -= 8;
+          max -= 8;
+          p += 8;
+          dst += 8;
+        }
+        if(n == 0)
+          break;
+      }
       if(*p == '\0'){
         *dst = '\0';
         got_null = 1;
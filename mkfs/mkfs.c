@@ -15,20 +15,25 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+//
+// The image is built in memory and written out in one go. Each
+// file's data blocks are allocated as one run, with its indirect
+// blocks after them, so that reading a file is sequential.
+
+int fssize = FSSIZE;     // -s: blocks in the file system
+int ninodes = 200;       // -i: inodes
+int nlog = LOGSIZE;      // -l: log blocks
+int nswap = 0;           // -w: swap blocks after the file system
+int nbitmap;
+int ninodeblocks;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // The whole image, fssize blocks.
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -38,8 +43,10 @@ void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
+uint iblock(uint, uint);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void iwrite(uint inum, int fd);
 void die(const char *);
 
 // convert to riscv byte order
@@ -68,7 +75,7 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, fd, c;
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
@@ -77,39 +84,78 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while((c = getopt(argc, argv, "s:i:l:w:")) != -1){
+    switch(c){
+    case 's':
+      fssize = atoi(optarg);
+      break;
+    case 'i':
+      ninodes = atoi(optarg);
+      break;
+    case 'l':
+      nlog = atoi(optarg);
+      break;
+    case 'w':
+      nswap = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+ usage:
+    fprintf(stderr, "Usage: mkfs [-s blocks] [-i inodes] [-l logblocks] [-w swapblocks] fs.img files...\n");
+    exit(1);
+  }
+  // the kernel logs at most LOGSIZE blocks per transaction, and
+  // counts inodes in ushorts.
+  if(nlog < MAXOPBLOCKS + 2 || nlog > LOGSIZE || ninodes < 2 || ninodes > 65535 ||
+     nswap < 0){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks, inodes 2 to 65535\n",
+            MAXOPBLOCKS + 2, LOGSIZE);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  // the log header (a count and LOGSIZE block numbers) is one block.
+  assert(sizeof(int) * (1 + LOGSIZE) <= BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
+  if(nblocks <= 0){
+    fprintf(stderr, "mkfs: %d blocks leave no room for data\n", fssize);
+    exit(1);
+  }
+  if((img = calloc(fssize, BSIZE)) == 0)
+    die("calloc");
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(fssize);
+  sb.nswap = xint(nswap);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
+  printf("swap %d blocks at %d\n", nswap, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
@@ -128,10 +174,12 @@ main(int argc, char *argv[])
   iappend(rootino, &de, sizeof(de));
 
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
+    // get rid of "user/" and "kernel/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
       shortname = argv[i] + 5;
+    else if(strncmp(argv[i], "kernel/", 7) == 0)
+      shortname = argv[i] + 7;
     else
       shortname = argv[i];
     
@@ -154,8 +202,7 @@ main(int argc, char *argv[])
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    iwrite(inum, fd);
 
     close(fd);
   }
@@ -169,16 +216,22 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  if(write(fsfd, img, (size_t)fssize * BSIZE) != (ssize_t)fssize * BSIZE)
+    die("write");
+  // the swap area needs no contents, only room in the image.
+  if(ftruncate(fsfd, (off_t)(fssize + nswap) * BSIZE) < 0)
+    die("ftruncate");
+  close(fsfd);
+
   exit(0);
 }
 
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  if(sec >= fssize)
+    die("wsect: out of blocks");
+  memmove(img + (size_t)sec * BSIZE, buf, BSIZE);
 }
 
 void
@@ -211,10 +264,9 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
+  if(sec >= fssize)
+    die("rsect: out of blocks");
+  memmove(buf, img + (size_t)sec * BSIZE, BSIZE);
 }
 
 uint
@@ -238,17 +290,33 @@ balloc(int used)
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used <= fssize);
+  // one bit per block, BSIZE*8 blocks per bitmap block.
+  for(int b = 0; b < used; b += BSIZE*8){
+    bzero(buf, BSIZE);
+    for(i = b; i < used && i < b + BSIZE*8; i++)
+      buf[(i-b)/8] = buf[(i-b)/8] | (0x1 << (i%8));
+    printf("balloc: write bitmap block at sector %d\n", xint(sb.bmapstart) + b/(BSIZE*8));
+    wsect(xint(sb.bmapstart) + b/(BSIZE*8), buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of indirect block addr, allocating it if necessary.
+uint
+iblock(uint addr, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(addr, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(addr, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +324,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -270,16 +337,17 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = iblock(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = fbn - NDIRECT - NINDIRECT;
+      x = iblock(iblock(xint(din.addrs[NDIRECT+1]), x / NINDIRECT), x % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -293,6 +361,71 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Set block fbn of inode din to x, allocating indirect blocks
+// as needed.
+void
+setblock(struct dinode *din, uint fbn, uint x)
+{
+  uint indirect[NINDIRECT];
+  uint addr;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    din->addrs[fbn] = xint(x);
+    return;
+  }
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0)
+      din->addrs[NDIRECT] = xint(freeblock++);
+    addr = xint(din->addrs[NDIRECT]);
+  } else {
+    fbn -= NINDIRECT;
+    if(xint(din->addrs[NDIRECT+1]) == 0)
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+    addr = iblock(xint(din->addrs[NDIRECT+1]), fbn / NINDIRECT);
+    fbn %= NINDIRECT;
+  }
+  rsect(addr, (char*)indirect);
+  indirect[fbn] = xint(x);
+  wsect(addr, (char*)indirect);
+}
+
+// Write the contents of fd to the empty file inum, its data in
+// one run of blocks and its indirect blocks after it.
+void
+iwrite(uint inum, int fd)
+{
+  struct dinode din;
+  char buf[BSIZE];
+  uint start, fbn = 0, size = 0;
+  int n, cc;
+
+  rinode(inum, &din);
+  start = freeblock;
+  for(;;){
+    for(n = 0; n < BSIZE && (cc = read(fd, buf + n, BSIZE - n)) > 0; n += cc)
+      ;
+    if(n == 0)
+      break;
+    bzero(buf + n, BSIZE - n);
+    wsect(start + fbn++, buf);
+    size += n;
+    if(n < BSIZE)
+      break;
+  }
+  if(size <= NINLINE){
+    // small enough to keep in the inode; the block is reused.
+    memmove(din.addrs, buf, size);
+    fbn = 0;
+  }
+  freeblock = start + fbn;
+  for(uint i = 0; i < fbn; i++)
+    setblock(&din, i, start + i);
+  din.size = xint(size);
+  winode(inum, &din);
+}
+
 void
 die(const char *s)
 {
@@ -1,10 +1,13 @@
 /*
  * memory allocation test for user, here call memtest() as a system call
- * update time: 2024-4-9
+ * update time: 2026-10-14
  * author: feng
- * version: 1.0
+ * version: 1.3
  * update log:
  * v1.0 -- main()
+ * v1.1 -- "-p N" runs the multi-hart stress test in N processes
+ * v1.2 -- "-b" runs the allocator benchmarks
+ * v1.3 -- "-s" runs the string benchmark
  */
 
 #include "kernel/types.h"
@@ -17,12 +20,71 @@ print(const char *s)
   write(1, s, strlen(s));
 }
 
-int main() {
-  if (memtest() == 0) {
+// printf is not linked in, convert the integer by hand
+void
+print_int(int num)
+{
+  char buf[16];
+  int i = 0;
+
+  do {
+    buf[i++] = '0' + num % 10;
+  } while ((num /= 10) > 0);
+  while (i-- > 0) {
+    write(1, &buf[i], 1);
+  }
+}
+
+// Run the multi-hart stress test in nproc processes at once.
+// Compare the elapsed ticks across CPUS=1..8 to see scaling.
+int
+mp_test(int nproc)
+{
+  int start, failed = 0, status;
+
+  start = uptime();
+  for (int i = 0; i < nproc; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      print("fork failed\n");
+      return -1;
+    }
+    if (pid == 0) {
+      exit(memtest(1) == 0 ? 0 : 1);
+    }
+  }
+  for (int i = 0; i < nproc; i++) {
+    wait(&status);
+    if (status != 0) {
+      failed++;
+    }
+  }
+
+  print_int(nproc);
+  print(" processes finished in ");
+  print_int(uptime() - start);
+  print(" ticks\n");
+  return failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  int r;
+
+  if (argc == 3 && strcmp(argv[1], "-p") == 0) {
+    r = mp_test(atoi(argv[2]));
+  } else if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+    r = memtest(2);
+  } else if (argc == 2 && strcmp(argv[1], "-s") == 0) {
+    r = memtest(3);
+  } else {
+    r = memtest(0);
+  }
+
+  if (r == 0) {
     print("Alloctest Success!\n");
   }
   else {
     print("Alloctest Failed!\n");
   }
   exit(0);
-}
\ No newline at end of file
+}
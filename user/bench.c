@@ -0,0 +1,349 @@
+/*
+ * scalability benchmarks: fork, exec, pipes, files and sbrk, each
+ * run by 1, 2, 4 .. N processes at once
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.1
+ * update log:
+ * v1.0 -- ops/s or KB/s per benchmark and process count;
+ *         "bench [-p N] [name ...]"
+ * v1.1 -- cat: a large file through cat(1) into a pipe
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define TICKSPERSEC 10  // uptime() ticks, about 1/10th second in qemu
+#define BUFSZ 4096
+
+char *prog;
+char buf[BUFSZ];
+
+// Each worker sets up, then waits for the others, runs ops
+// operations and exits 0 on success.
+struct bench {
+  char *name;
+  int ops;      // per worker
+  int bytes;    // moved by one op; 0 reports ops/s, else KB/s
+  int (*setup)(int id);
+  int (*run)(int id, int ops);
+};
+
+// a file name of the worker's own, "<c><id>".
+static char*
+name(char c, int id)
+{
+  static char n[4];
+
+  n[0] = c;
+  n[1] = '0' + id / 10;
+  n[2] = '0' + id % 10;
+  n[3] = 0;
+  return n;
+}
+
+static int
+forkrun(int id, int ops)
+{
+  int pid, xstatus;
+
+  for(int i = 0; i < ops; i++){
+    if((pid = fork()) < 0)
+      return -1;
+    if(pid == 0)
+      exit(0);
+    if(wait(&xstatus) != pid || xstatus != 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int
+execrun(int id, int ops)
+{
+  char *argv[] = { prog, "-x", 0 };
+  int pid, xstatus;
+
+  for(int i = 0; i < ops; i++){
+    if((pid = fork()) < 0)
+      return -1;
+    if(pid == 0){
+      exec(prog, argv);
+      exit(1);
+    }
+    if(wait(&xstatus) != pid || xstatus != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// one op is a round trip of a byte through two pipes.
+static int
+pingpongrun(int id, int ops)
+{
+  int p1[2], p2[2], pid, xstatus;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    close(p1[1]);
+    close(p2[0]);
+    while(read(p1[0], &c, 1) == 1)
+      write(p2[1], &c, 1);
+    exit(0);
+  }
+  close(p1[0]);
+  close(p2[1]);
+  for(int i = 0; i < ops; i++)
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1)
+      return -1;
+  close(p1[1]);
+  close(p2[0]);
+  wait(&xstatus);
+  return xstatus == 0 ? 0 : -1;
+}
+
+// one op is BUFSZ bytes written into a pipe and read out.
+static int
+pipebwrun(int id, int ops)
+{
+  int p[2], pid, xstatus, n, total = 0;
+
+  if(pipe(p) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    close(p[1]);
+    while((n = read(p[0], buf, BUFSZ)) > 0)
+      total += n;
+    exit(total == ops * BUFSZ ? 0 : 1);
+  }
+  close(p[0]);
+  for(int i = 0; i < ops; i++)
+    if(write(p[1], buf, BUFSZ) != BUFSZ)
+      return -1;
+  close(p[1]);
+  wait(&xstatus);
+  return xstatus == 0 ? 0 : -1;
+}
+
+// one op creates, writes, closes and unlinks a small file.
+static int
+filesrun(int id, int ops)
+{
+  int fd;
+
+  for(int i = 0; i < ops; i++){
+    if((fd = open(name('s', id), O_CREATE | O_RDWR)) < 0)
+      return -1;
+    if(write(fd, buf, 100) != 100)
+      return -1;
+    close(fd);
+    if(unlink(name('s', id)) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// one op writes BUFSZ bytes of a large file, left for readrun().
+static int
+writerun(int id, int ops)
+{
+  int fd;
+
+  if((fd = open(name('b', id), O_CREATE | O_TRUNC | O_RDWR)) < 0)
+    return -1;
+  for(int i = 0; i < ops; i++)
+    if(write(fd, buf, BUFSZ) != BUFSZ)
+      return -1;
+  close(fd);
+  return 0;
+}
+
+static int
+readsetup(int id)
+{
+  return writerun(id, 64);
+}
+
+static int
+readrun(int id, int ops)
+{
+  int fd;
+
+  if((fd = open(name('b', id), O_RDONLY)) < 0)
+    return -1;
+  for(int i = 0; i < ops; i++)
+    if(read(fd, buf, BUFSZ) != BUFSZ)
+      return -1;
+  close(fd);
+  return unlink(name('b', id));
+}
+
+static int
+catsetup(int id)
+{
+  int fd;
+
+  if((fd = open(name('c', id), O_CREATE | O_TRUNC | O_RDWR)) < 0)
+    return -1;
+  for(int i = 0; i < 128; i++)
+    if(write(fd, buf, BUFSZ) != BUFSZ)
+      return -1;
+  close(fd);
+  return 0;
+}
+
+// one op is BUFSZ bytes of a large file that cat copies into a
+// pipe, as in "cat file | wc": all of it goes through copyout()
+// and copyin(). cat is in the top directory.
+static int
+catrun(int id, int ops)
+{
+  char *argv[] = { "cat", name('c', id), 0 };
+  int p[2], pid, xstatus, n, total = 0;
+
+  if(pipe(p) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    close(1);
+    dup(p[1]);
+    close(p[0]);
+    close(p[1]);
+    exec("cat", argv);
+    exit(1);
+  }
+  close(p[1]);
+  while((n = read(p[0], buf, BUFSZ)) > 0)
+    total += n;
+  close(p[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || total != ops * BUFSZ)
+    return -1;
+  return unlink(name('c', id));
+}
+
+// one op is a page grown with sbrk(), faulted in and given back,
+// 256 at a time.
+static int
+sbrkrun(int id, int ops)
+{
+  char *p;
+
+  for(int i = 0; i < ops; i += 256){
+    if((p = sbrk(256 * 4096)) == (char*)-1)
+      return -1;
+    for(int off = 0; off < 256 * 4096; off += 4096)
+      p[off] = 1;
+    sbrk(-256 * 4096);
+  }
+  return 0;
+}
+
+struct bench benches[] = {
+  { "fork", 200, 0, 0, forkrun },
+  { "exec", 50, 0, 0, execrun },
+  { "pingpong", 2000, 0, 0, pingpongrun },
+  { "pipebw", 256, BUFSZ, 0, pipebwrun },
+  { "files", 200, 0, 0, filesrun },
+  { "write", 64, BUFSZ, 0, writerun },
+  { "read", 64, BUFSZ, readsetup, readrun },
+  { "cat", 128, BUFSZ, catsetup, catrun },
+  { "sbrk", 2048, 0, 0, sbrkrun },
+};
+
+// Run b in nproc workers at once and print their combined rate.
+// The workers start together: each writes a byte to ready when
+// set up, and waits on go for the parent to release them all.
+int
+runbench(struct bench *b, int nproc)
+{
+  int ready[2], go[2], pid, xstatus, start, ticks, ok, failed = 0;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(go) < 0)
+    return -1;
+  for(int i = 0; i < nproc; i++){
+    if((pid = fork()) < 0)
+      return -1;
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      ok = b->setup == 0 || b->setup(i) == 0;
+      write(ready[1], "r", 1);
+      if(read(go[0], &c, 1) != 1 || !ok)
+        exit(1);
+      exit(b->run(i, b->ops) < 0 ? 1 : 0);
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(int i = 0; i < nproc; i++)
+    if(read(ready[0], &c, 1) != 1)
+      break;
+  start = uptime();
+  for(int i = 0; i < nproc; i++)
+    write(go[1], "g", 1);
+  close(go[1]);
+  for(int i = 0; i < nproc; i++){
+    wait(&xstatus);
+    failed |= xstatus != 0;
+  }
+  ticks = uptime() - start;
+  close(ready[0]);
+  if(failed){
+    printf("%s %d procs: failed\n", b->name, nproc);
+    return -1;
+  }
+  if(ticks == 0)
+    ticks = 1;
+  if(b->bytes)
+    printf("%s %d procs: %d KB/s\n", b->name, nproc,
+           b->ops * nproc * (b->bytes / 1024) * TICKSPERSEC / ticks);
+  else
+    printf("%s %d procs: %d ops/s\n", b->name, nproc,
+           b->ops * nproc * TICKSPERSEC / ticks);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxproc = 4, i, r = 0;
+
+  prog = argv[0];
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);      // the program execrun() runs
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-p") == 0){
+    if((maxproc = atoi(argv[2])) < 1 || maxproc > 99){
+      fprintf(2, "bench: bad process count\n");
+      exit(1);
+    }
+    i = 3;
+  }
+  for(int j = 0; j < sizeof(benches)/sizeof(benches[0]); j++){
+    int k;
+    for(k = i; k < argc && strcmp(argv[k], benches[j].name) != 0; k++)
+      ;
+    if(i < argc && k == argc)
+      continue;
+    for(int n = 1; ; n *= 2){
+      if(n > maxproc)
+        n = maxproc;
+      if(runbench(&benches[j], n) < 0)
+        r = 1;
+      if(n == maxproc)
+        break;
+    }
+  }
+  exit(r);
+}
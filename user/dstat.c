@@ -0,0 +1,35 @@
+/*
+ * print the state of the kernel's dalloc heap
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- usage, fragmentation and counters; "-h" adds the free-block histogram
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/dstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct dstat st;
+
+  if(dstat(&st) < 0){
+    fprintf(2, "dstat: failed\n");
+    exit(1);
+  }
+  printf("heap %l KB, in use %l KB, cached %l KB, free %l KB\n",
+         st.heapsize / 1024, st.inuse / 1024, st.cached / 1024, st.freebytes / 1024);
+  printf("free blocks %l, largest %l KB, fragmentation %l%%\n", st.nfreeblocks,
+         st.largest / 1024, st.freebytes ? 100 - st.largest * 100 / st.freebytes : 0);
+  printf("dalloc %l, dfree %l, lock contended %l\n", st.nalloc, st.nfree, st.contended);
+  if(argc > 1 && strcmp(argv[1], "-h") == 0){
+    for(int i = 0; i < DSTAT_NBINS; i++)
+      if(st.hist[i])
+        printf("%l B and up: %l\n", 16L << i, st.hist[i]);
+  }
+  exit(0);
+}
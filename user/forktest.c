@@ -6,6 +6,7 @@
 #include "user/user.h"
 
 #define N  1000
+#define NEXEC 50
 
 void
 print(const char *s)
@@ -48,9 +49,58 @@ forktest(void)
   print("fork test OK\n");
 }
 
+void
+printint(int n)
+{
+  char buf[16];
+  int i = 0;
+
+  do {
+    buf[i++] = '0' + n % 10;
+  } while((n /= 10) > 0);
+  while(i-- > 0)
+    write(1, &buf[i], 1);
+}
+
+// Time fork+exec+wait of this (tiny) program, the pattern
+// sh uses for every command.
+void
+forkexectest(char *self)
+{
+  int i, pid, start;
+  char *argv[] = { self, "-e", 0 };
+
+  print("fork+exec test\n");
+
+  start = uptime();
+  for(i = 0; i < NEXEC; i++){
+    pid = fork();
+    if(pid < 0){
+      print("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(self, argv);
+      print("exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+
+  printint(NEXEC);
+  print(" fork+exec+wait in ");
+  printint(uptime() - start);
+  print(" ticks\n");
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
+  // child of forkexectest(): nothing to do.
+  if(argc > 1 && strcmp(argv[1], "-e") == 0)
+    exit(0);
+
   forktest();
+  forkexectest(argv[0]);
   exit(0);
 }
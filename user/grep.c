@@ -2,35 +2,142 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[1024];
+char buf[16384];
+char obuf[4096];
+int on;
 int match(char*, char*);
 
+// A pattern without operators is searched for across the whole
+// buffer with Boyer-Moore-Horspool, rather than by trying the
+// matcher at every position of every line; only the lines it
+// turns up are delimited.
+int literal;
+int plen;
+int skip[256];
+
+void
+compile(char *pattern)
+{
+  int i;
+
+  plen = strlen(pattern);
+  literal = plen > 0 && pattern[0] != '^' && pattern[plen-1] != '$';
+  for(i = 0; i < plen; i++)
+    if(pattern[i] == '.' || pattern[i] == '*' || pattern[i] == '\n')
+      literal = 0;
+  if(!literal)
+    return;
+  for(i = 0; i < 256; i++)
+    skip[i] = plen;
+  for(i = 0; i < plen-1; i++)
+    skip[(uchar)pattern[i]] = plen-1 - i;
+}
+
+// first occurrence of the literal pattern in [p, end), or 0.
+char*
+search(char *pattern, char *p, char *end)
+{
+  uchar last = pattern[plen-1];
+  uchar c;
+
+  while(end - p >= plen){
+    c = p[plen-1];
+    if(c == last && memcmp(p, pattern, plen-1) == 0)
+      return p;
+    p += skip[c];
+  }
+  return 0;
+}
+
+// matching lines are collected in obuf and written out in few
+// write()s.
+void
+output(char *p, int n)
+{
+  if(on + n > sizeof(obuf)){
+    write(1, obuf, on);
+    on = 0;
+  }
+  if(n > sizeof(obuf)){
+    write(1, p, n);
+    return;
+  }
+  memmove(obuf + on, p, n);
+  on += n;
+}
+
+void
+flush(void)
+{
+  if(on > 0)
+    write(1, obuf, on);
+  on = 0;
+}
+
+// grep the complete lines in [p, end) in place; the lines can
+// be cut with NULs. Returns the start of the unfinished line
+// at the end.
+char*
+grepbuf(char *pattern, char *p, char *end)
+{
+  char *last, *q;
+  int n;
+
+  for(last = end; last > p && last[-1] != '\n'; last--)
+    ;
+  if(literal){
+    while((q = search(pattern, p, last)) != 0){
+      while(q > p && q[-1] != '\n')
+        q--;
+      p = q;
+      while(*q != '\n')
+        q++;
+      output(p, q+1 - p);
+      p = q+1;
+    }
+    return last;
+  }
+  for(; p < last; p = q+1){
+    for(q = p; *q != '\n'; q++)
+      ;
+    *q = 0;
+    n = match(pattern, p);
+    *q = '\n';
+    if(n)
+      output(p, q+1 - p);
+  }
+  return last;
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
-  char *p, *q;
+  char *p;
+  struct stat st;
+
+  // a regular file is scanned where it is mapped, without
+  // a read() and a copy for every buffer full. The mapping
+  // is private, so its lines can be cut too.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+     (p = mmap(0, st.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) != (char*)-1){
+    grepbuf(pattern, p, p + st.size);
+    flush();
+    munmap(p, st.size);
+    return;
+  }
 
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
+  while((n = read(fd, buf+m, sizeof(buf)-m)) > 0){
     m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
-    }
+    p = grepbuf(pattern, buf, buf+m);
+    m -= p - buf;
+    memmove(buf, p, m);
   }
+  flush();
 }
 
 int
@@ -44,6 +151,7 @@ main(int argc, char *argv[])
     exit(1);
   }
   pattern = argv[1];
+  compile(pattern);
 
   if(argc <= 2){
     grep(pattern, 0);
@@ -0,0 +1,41 @@
+/*
+ * print buffer cache, disk and log statistics
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.2
+ * update log:
+ * v1.0 -- hit rate, disk queue depth and latency, blocks per commit
+ * v1.1 -- swap area usage
+ * v1.2 -- log writebacks
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat st;
+  uint64 lookups;
+
+  if(iostat(&st) < 0){
+    fprintf(2, "iostat: failed\n");
+    exit(1);
+  }
+  lookups = st.bhit + st.bmiss;
+  printf("bcache: %l buffers, %l hits, %l misses (%l%% hit), %l evictions\n",
+         st.nbuf, st.bhit, st.bmiss, lookups ? st.bhit * 100 / lookups : 0, st.bevict);
+  printf("bread %l, bwrite %l, readahead %l\n", st.bread, st.bwrite, st.readahead);
+  // 10 timer cycles a microsecond.
+  printf("disk: %l requests, %l blocks, avg %l us, max %l us, %l in flight, max %l\n",
+         st.dreq, st.dblocks, st.dreq ? st.dtime / st.dreq / 10 : 0,
+         st.dmaxtime / 10, st.dqueue, st.dmaxqueue);
+  printf("log: %l commits, avg %l blocks, max %l\n", st.commits,
+         st.commits ? st.logblocks / st.commits : 0, st.maxcommit);
+  printf("writeback: %l installs, %l blocks\n", st.installs, st.homeblocks);
+  printf("swap: %l of %l pages used, %l out, %l in\n", st.swapused,
+         st.swapslots, st.swapout, st.swapin);
+  exit(0);
+}
@@ -0,0 +1,64 @@
+/*
+ * print the kernel's spinlock counters
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- counters since boot, or "lockstat cmd args" for one command's
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+// Counters of the locks used while running argv, by taking
+// them before and after. maxhold stays the all-time maximum.
+int
+run(char **argv, int *nbefore)
+{
+  int pid;
+
+  if((*nbefore = lockstat(before, NLOCKSTAT)) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    exec(argv[0], argv);
+    fprintf(2, "lockstat: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  wait(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, nbefore = 0;
+
+  if(argc > 1 && run(argv + 1, &nbefore) < 0){
+    fprintf(2, "lockstat: failed\n");
+    exit(1);
+  }
+  if((n = lockstat(after, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: failed\n");
+    exit(1);
+  }
+  // names are only ever added, so entry i names the same locks.
+  for(int i = 0; i < nbefore; i++){
+    after[i].acquire -= before[i].acquire;
+    after[i].contended -= before[i].contended;
+    after[i].spins -= before[i].spins;
+  }
+  printf("name acquire contended spins maxhold\n");
+  for(int i = 0; i < n; i++){
+    if(after[i].acquire == 0)
+      continue;
+    printf("%s %l %l %l %l\n", after[i].name, after[i].acquire,
+           after[i].contended, after[i].spins, after[i].maxhold);
+  }
+  exit(0);
+}
@@ -0,0 +1,185 @@
+/*
+ * malloc benchmark: size-class malloc() against the old K&R one
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- churn() of random small blocks, big() of large ones
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NLIVE 2000      // blocks kept allocated during churn()
+#define NOPS 200000     // free/malloc pairs in churn()
+#define NBIG 200        // large blocks in big()
+
+// The K&R allocator umalloc.c used to be, kept here to compare
+// against. Its free list holds every free block, so its cost
+// grows with fragmentation.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+struct allocator {
+  char *name;
+  void *(*alloc)(uint);
+  void (*free)(void*);
+};
+
+static uint seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+// Keep NLIVE blocks of 16..1040 bytes allocated and replace a
+// random one NOPS times, which fragments a first-fit list.
+int
+churn(struct allocator *a)
+{
+  static char *live[NLIVE];
+  char *brk = sbrk(0);
+  int start, i, j;
+
+  seed = 1;
+  start = uptime();
+  for(i = 0; i < NLIVE; i++)
+    if((live[i] = a->alloc(16 + rand() % 1024)) == 0)
+      return -1;
+  for(i = 0; i < NOPS; i++){
+    j = rand() % NLIVE;
+    a->free(live[j]);
+    if((live[j] = a->alloc(16 + rand() % 1024)) == 0)
+      return -1;
+    live[j][0] = 1;
+  }
+  for(i = 0; i < NLIVE; i++)
+    a->free(live[i]);
+  printf("%s churn: %d ops in %d ticks, heap grew %d KB\n", a->name, NOPS,
+         uptime() - start, (int)(sbrk(0) - brk) / 1024);
+  return 0;
+}
+
+// Allocate and free NBIG blocks of 64 KB, touching each page;
+// memory given back on free shows as a heap that stays put.
+int
+big(struct allocator *a)
+{
+  char *brk = sbrk(0);
+  char *p;
+  int start, i;
+
+  start = uptime();
+  for(i = 0; i < NBIG; i++){
+    if((p = a->alloc(65536)) == 0)
+      return -1;
+    for(int off = 0; off < 65536; off += 4096)
+      p[off] = 1;
+    a->free(p);
+  }
+  printf("%s big: %d blocks in %d ticks, heap at end %d KB above start\n",
+         a->name, NBIG, uptime() - start, (int)(sbrk(0) - brk) / 1024);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct allocator as[] = {
+    { "K&R", krmalloc, krfree },
+    { "malloc", malloc, free },
+  };
+
+  for(int i = 0; i < sizeof(as)/sizeof(as[0]); i++){
+    if(churn(&as[i]) < 0 || big(&as[i]) < 0){
+      printf("mallocbench: %s out of memory\n", as[i].name);
+      exit(1);
+    }
+  }
+  exit(0);
+}
@@ -6,18 +6,96 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output buffered per descriptor. The console is flushed at
+// the end of every printf() call, so a prompt without a newline
+// still shows; files and pipes only once the buffer fills, and
+// at fflush(), close(), fork(), exec() and exit(). A program that
+// mixes write() and printf() on a file should fflush() in between.
+// Threads made by clone() share the buffers, under outlock.
+#define NOUTFD 16     // descriptors with a buffer; others have none
+#define OUTBUFSZ 512
+#define TERM 1        // flushed after each call
+#define FULL 2        // flushed when full
+
+static struct {
+  char buf[OUTBUFSZ];
+  int n;              // bytes in buf
+  int mode;           // 0 until the first printf(), then TERM or FULL
+} out[NOUTFD];
+static int outlock;
+
+static void
+lockout(void)
+{
+  while(__sync_lock_test_and_set(&outlock, 1) != 0)
+    ;
+}
+
+static void
+unlockout(void)
+{
+  __sync_lock_release(&outlock);
+}
+
+// Caller must hold outlock.
+static void
+flush(int fd)
+{
+  if(fd < 0 || fd >= NOUTFD || out[fd].n == 0)
+    return;
+  write(fd, out[fd].buf, out[fd].n);
+  out[fd].n = 0;
+}
+
+void
+fflush(int fd)
+{
+  lockout();
+  flush(fd);
+  unlockout();
+}
+
+static void
+flushall(void)
+{
+  lockout();
+  for(int fd = 0; fd < NOUTFD; fd++)
+    flush(fd);
+  unlockout();
+}
+
+// Called by close() before fd goes: the next file to get the
+// number may be of another kind.
+static void
+closed(int fd)
+{
+  if(fd < 0 || fd >= NOUTFD)
+    return;
+  lockout();
+  flush(fd);
+  out[fd].mode = 0;
+  unlockout();
+}
+
+// Caller must hold outlock.
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  if(fd < 0 || fd >= NOUTFD){
+    write(fd, &c, 1);
+    return;
+  }
+  if(out[fd].n == OUTBUFSZ)
+    flush(fd);
+  out[fd].buf[out[fd].n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(int fd, long xx, int base, int sgn)
 {
-  char buf[16];
+  char buf[24];
   int i, neg;
-  uint x;
+  uint64 x;
 
   neg = 0;
   if(sgn && xx < 0){
@@ -51,9 +129,18 @@ printptr(int fd, uint64 x) {
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  extern void (*_flushall)(void);
+  extern void (*_closed)(int);
+  struct stat st;
   char *s;
   int c, i, state;
 
+  lockout();
+  if(fd >= 0 && fd < NOUTFD && out[fd].mode == 0){
+    out[fd].mode = fstat(fd, &st) == 0 && st.type == T_DEVICE ? TERM : FULL;
+    _flushall = flushall;
+    _closed = closed;
+  }
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -69,7 +156,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       } else if(c == 'l') {
         printint(fd, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(fd, va_arg(ap, uint), 16, 0);
       } else if(c == 'p') {
         printptr(fd, va_arg(ap, uint64));
       } else if(c == 's'){
@@ -92,6 +179,9 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOUTFD && out[fd].mode == TERM)
+    flush(fd);
+  unlockout();
 }
 
 void
@@ -0,0 +1,204 @@
+/*
+ * profile a command with the kernel's sampling profiler
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- "prof cmd args": samples by function, named from kernel.sym and cmd.sym
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/prof.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NSAMPLE (NCPU * PROFNBUF)
+#define NHIT 256
+
+struct sym {
+  uint64 addr;
+  char *name;
+};
+
+struct symtab {
+  struct sym *s;
+  int n;
+};
+
+struct hit {
+  char *name;
+  int user;
+  int n;
+};
+
+struct profsample samples[NSAMPLE];
+struct hit hits[NHIT];
+int nhit;
+
+static uint64
+hex(char **pp)
+{
+  uint64 v = 0;
+  char *p = *pp;
+
+  for(;; p++){
+    if(*p >= '0' && *p <= '9')
+      v = v * 16 + *p - '0';
+    else if(*p >= 'a' && *p <= 'f')
+      v = v * 16 + *p - 'a' + 10;
+    else
+      break;
+  }
+  *pp = p;
+  return v;
+}
+
+// Load a symbol file the Makefile made with objdump -t, one
+// "address name" per line, sorted by address. Section names,
+// which start with a '.', are left out.
+int
+loadsyms(char *path, struct symtab *t)
+{
+  struct stat st;
+  char *buf, *p, *q;
+  int fd, n, i, j;
+
+  t->n = 0;
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+    close(fd);
+    return -1;
+  }
+  for(n = 0; n < st.size; n += i)
+    if((i = read(fd, buf + n, st.size - n)) <= 0)
+      break;
+  close(fd);
+  buf[n] = 0;
+
+  for(i = 0, p = buf; *p; p++)
+    if(*p == '\n')
+      i++;
+  if((t->s = malloc((i + 1) * sizeof(struct sym))) == 0)
+    return -1;
+  for(p = buf; *p; p = q){
+    for(q = p; *q && *q != '\n'; q++)
+      ;
+    if(*q)
+      *q++ = 0;
+    uint64 addr = hex(&p);
+    if(*p++ != ' ' || *p == '.' || *p == 0)
+      continue;
+    // insertion sort; the file is nearly sorted already.
+    for(j = t->n; j > 0 && t->s[j-1].addr > addr; j--)
+      t->s[j] = t->s[j-1];
+    t->s[j].addr = addr;
+    t->s[j].name = p;
+    t->n++;
+  }
+  return 0;
+}
+
+// The function containing pc: the last symbol at or below it.
+char*
+lookup(struct symtab *t, uint64 pc)
+{
+  int lo = 0, hi = t->n;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(t->s[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? t->s[lo-1].name : "?";
+}
+
+void
+count(char *name, int user)
+{
+  int i;
+
+  for(i = 0; i < nhit; i++)
+    if(hits[i].name == name && hits[i].user == user)
+      break;
+  if(i == nhit){
+    if(nhit == NHIT)
+      return;
+    hits[nhit].name = name;
+    hits[nhit].user = user;
+    hits[nhit++].n = 0;
+  }
+  hits[i].n++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct symtab ksyms, usyms;
+  char path[32], *base, *s;
+  int pid, n, dropped;
+
+  if(argc < 2){
+    fprintf(2, "usage: prof cmd args\n");
+    exit(1);
+  }
+
+  profstart();
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  dropped = profstop();
+  if((n = profread(samples, NSAMPLE)) < 0){
+    fprintf(2, "prof: profread failed\n");
+    exit(1);
+  }
+
+  for(base = s = argv[1]; *s; s++)
+    if(*s == '/')
+      base = s + 1;
+  if(strlen(base) + 5 > sizeof(path))
+    base = "";
+  strcpy(path, base);
+  strcpy(path + strlen(path), ".sym");
+  if(loadsyms("/kernel.sym", &ksyms) < 0)
+    fprintf(2, "prof: no /kernel.sym, kernel samples unnamed\n");
+  if(loadsyms(path, &usyms) < 0)
+    fprintf(2, "prof: no %s, user samples unnamed\n", path);
+
+  for(int i = 0; i < n; i++){
+    struct profsample *p = &samples[i];
+    if(p->user && p->pid != pid)
+      count("(other process)", 1);
+    else if(p->user)
+      count(lookup(&usyms, p->pc), 1);
+    else if(p->pid == 0)
+      count("(idle)", 0);
+    else
+      count(lookup(&ksyms, p->pc), 0);
+  }
+
+  // most samples first.
+  for(int i = 1; i < nhit; i++){
+    struct hit h = hits[i];
+    int j;
+    for(j = i; j > 0 && hits[j-1].n < h.n; j--)
+      hits[j] = hits[j-1];
+    hits[j] = h;
+  }
+  printf("%d samples, %d dropped\n", n, dropped);
+  for(int i = 0; i < nhit; i++)
+    printf("%d %d%% %s %s\n", hits[i].n, hits[i].n * 100 / n,
+           hits[i].user ? "user" : "kernel", hits[i].name);
+  exit(0);
+}
@@ -0,0 +1,38 @@
+/*
+ * list processes with their accounting
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- one procstat() call for the whole table
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/procstat.h"
+#include "user/user.h"
+
+struct procstat ps[NPROC];
+
+char *states[] = { "unused", "used", "sleep ", "runble", "run   ", "zombie" };
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if((n = procstat(ps, NPROC)) < 0){
+    fprintf(2, "ps: procstat failed\n");
+    exit(1);
+  }
+  printf("pid state name ticks vcsw ivcsw syscalls rblocks wblocks pages KB\n");
+  for(int i = 0; i < n; i++){
+    struct procstat *p = &ps[i];
+    char *state = p->state >= 0 && p->state < 6 ? states[p->state] : "???";
+    printf("%d %s %s %l %l %l %l %l %l %l %l\n", p->pid, state, p->name,
+           p->rticks, p->nvcsw, p->nivcsw, p->nsyscall, p->nread, p->nwrite,
+           p->npages, p->sz / 1024);
+  }
+  exit(0);
+}
@@ -0,0 +1,183 @@
+/*
+ * scheduler benchmark: wakeup latency and CPU-bound throughput
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.2
+ * update log:
+ * v1.0 -- pingpong() and spin(), compare runs with CPUS=3 and CPUS=8
+ * v1.1 -- "-m N": pingpong() next to N CPU hogs, for the MLFQ levels
+ * v1.2 -- scheduler lock contention from lockstat() after each test
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define ROUNDS 2000      // pipe round trips
+#define SPINS 50000000   // loop iterations per CPU-bound child
+
+struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+int nbefore;
+
+// Remember the lock counters so contention() can print what
+// the next test added to them.
+void
+snapshot(void)
+{
+  if ((nbefore = lockstat(before, NLOCKSTAT)) < 0)
+    nbefore = 0;
+}
+
+// The locks scheduler() and wakeup() take, since snapshot():
+// contended/acquire is what changes between CPUS=3 and CPUS=8.
+void
+contention(char *test)
+{
+  static char *names[] = { "runq", "waitq", "proc" };
+  int n;
+
+  if ((n = lockstat(after, NLOCKSTAT)) < 0)
+    return;
+  // names are only ever added, so entry i names the same locks.
+  for (int i = 0; i < n; i++) {
+    if (i < nbefore) {
+      after[i].acquire -= before[i].acquire;
+      after[i].contended -= before[i].contended;
+      after[i].spins -= before[i].spins;
+    }
+    for (int j = 0; j < sizeof(names)/sizeof(names[0]); j++) {
+      if (strcmp(after[i].name, names[j]) == 0)
+        printf("%s: %s lock %l acquires, %l contended, %l spins\n", test,
+               after[i].name, after[i].acquire, after[i].contended,
+               after[i].spins);
+    }
+  }
+}
+
+// Two processes bounce a byte over a pair of pipes, so every
+// round trip is two wakeups and two trips through scheduler().
+int
+pingpong(void)
+{
+  int p1[2], p2[2], start, pid;
+  char c = 0;
+
+  if (pipe(p1) < 0 || pipe(p2) < 0) {
+    printf("schedtest: pipe failed\n");
+    return -1;
+  }
+  start = uptime();
+  if ((pid = fork()) < 0) {
+    printf("schedtest: fork failed\n");
+    return -1;
+  }
+  if (pid == 0) {
+    for (int i = 0; i < ROUNDS; i++) {
+      if (read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for (int i = 0; i < ROUNDS; i++) {
+    if (write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1) {
+      printf("schedtest: pingpong failed\n");
+      return -1;
+    }
+  }
+  wait(0);
+  printf("pingpong: %d round trips in %d ticks\n", ROUNDS, uptime() - start);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+  return 0;
+}
+
+// nproc CPU-bound children at once; with enough CPUs the
+// elapsed time stays flat as long as the run queues spread them.
+int
+spin(int nproc)
+{
+  int start, status, failed = 0;
+
+  start = uptime();
+  for (int i = 0; i < nproc; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("schedtest: fork failed\n");
+      return -1;
+    }
+    if (pid == 0) {
+      volatile int x = 0;
+      for (int j = 0; j < SPINS; j++)
+        x++;
+      exit(0);
+    }
+  }
+  for (int i = 0; i < nproc; i++) {
+    wait(&status);
+    if (status != 0)
+      failed++;
+  }
+  printf("spin: %d processes in %d ticks\n", nproc, uptime() - start);
+  return failed == 0 ? 0 : -1;
+}
+
+// pingpong() while nproc CPU hogs run: the hogs sink to the
+// lowest level, so the round trips should barely slow down.
+int
+loaded(int nproc)
+{
+  int pids[NPROC], r;
+
+  if (nproc > NPROC)
+    nproc = NPROC;
+  for (int i = 0; i < nproc; i++) {
+    if ((pids[i] = fork()) < 0) {
+      printf("schedtest: fork failed\n");
+      nproc = i;
+      break;
+    }
+    if (pids[i] == 0) {
+      for (;;)
+        ;
+    }
+  }
+  r = pingpong();
+  for (int i = 0; i < nproc; i++) {
+    kill(pids[i]);
+    wait(0);
+  }
+  return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 8;
+
+  if (argc == 3 && strcmp(argv[1], "-m") == 0) {
+    if (loaded(atoi(argv[2])) < 0) {
+      printf("schedtest failed\n");
+      exit(1);
+    }
+    exit(0);
+  }
+  if (argc > 1)
+    nproc = atoi(argv[1]);
+  snapshot();
+  if (pingpong() < 0) {
+    printf("schedtest failed\n");
+    exit(1);
+  }
+  contention("pingpong");
+  snapshot();
+  if (spin(nproc) < 0) {
+    printf("schedtest failed\n");
+    exit(1);
+  }
+  contention("spin");
+  exit(0);
+}
@@ -52,6 +52,8 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int gettoken(char**, char*, char**, char**);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +133,97 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Is buf a pipeline of plain commands with redirections? Such
+// a line parses without a syntax panic, so the shell itself can
+// parse it and run it with spawn().
+int
+simple(char *buf)
+{
+  char *s = buf, *es = buf + strlen(buf);
+  int tok, nargs;
+
+  for(;;){
+    nargs = 0;
+    while((tok = gettoken(&s, es, 0, 0)) == 'a' || tok == '<' || tok == '>' || tok == '+'){
+      if(tok != 'a' && gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+      if(tok == 'a' && ++nargs >= MAXARGS)
+        return 0;
+    }
+    if(nargs == 0)
+      return 0;
+    if(tok == 0)
+      return 1;
+    if(tok != '|')
+      return 0;
+  }
+}
+
+// Start a stage of a spawned pipeline: cmd with the redirections
+// around it, reading in and writing out. Returns its pid, or -1.
+int
+spawncmd(struct cmd *cmd, int in, int out)
+{
+  int fd[3], opened[3], i, pid;
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+
+  fd[0] = in;
+  fd[1] = out;
+  fd[2] = 2;
+  opened[0] = opened[1] = opened[2] = -1;
+  // the innermost redirection of a descriptor wins, as in runcmd().
+  pid = -1;
+  for(; cmd->type == REDIR; cmd = rcmd->cmd){
+    rcmd = (struct redircmd*)cmd;
+    if((i = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      goto out;
+    }
+    if(opened[rcmd->fd] >= 0)
+      close(opened[rcmd->fd]);
+    fd[rcmd->fd] = opened[rcmd->fd] = i;
+  }
+  ecmd = (struct execcmd*)cmd;
+  if((pid = spawn(ecmd->argv[0], ecmd->argv, fd)) < 0)
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+ out:
+  for(i = 0; i < 3; i++)
+    if(opened[i] >= 0)
+      close(opened[i]);
+  return pid;
+}
+
+// Run a simple() pipeline without forking the shell: each stage
+// is spawn()ed with its ends of the pipes, and waited for.
+void
+spawnpipe(struct cmd *cmd)
+{
+  int p[2], in = 0, n = 0;
+  struct pipecmd *pcmd;
+
+  while(cmd->type == PIPE){
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      break;
+    }
+    if(spawncmd(pcmd->left, in, p[1]) >= 0)
+      n++;
+    close(p[1]);
+    if(in != 0)
+      close(in);
+    in = p[0];
+    cmd = pcmd->right;
+  }
+  if(cmd->type != PIPE && spawncmd(cmd, in, 1) >= 0)
+    n++;
+  if(in != 0)
+    close(in);
+  while(n-- > 0)
+    wait(0);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -165,6 +258,12 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simple(buf)){
+      struct cmd *cmd = parsecmd(buf);
+      spawnpipe(cmd);
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -446,6 +545,31 @@ parseexec(char **ps, char *es)
   return ret;
 }
 
+// Free a command parsed by the shell itself.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
 // NUL-terminate all the counted strings.
 struct cmd*
 nulterminate(struct cmd *cmd)
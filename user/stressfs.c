@@ -13,25 +13,23 @@
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 
-int
-main(int argc, char *argv[])
+#define NWORKER 5        // processes or threads
+#define STACKSIZE 4096   // user stack of each thread
+
+// Write file stressfs<i>, then read it back.
+void
+stress(int i)
 {
-  int fd, i;
+  int fd, n;
   char path[] = "stressfs0";
   char data[512];
 
-  printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
-
-  for(i = 0; i < 4; i++)
-    if(fork() > 0)
-      break;
-
   printf("write %d\n", i);
 
   path[8] += i;
   fd = open(path, O_CREATE | O_RDWR);
-  for(i = 0; i < 20; i++)
+  for(n = 0; n < 20; n++)
 //    printf(fd, "%d\n", i);
     write(fd, data, sizeof(data));
   close(fd);
@@ -39,9 +37,45 @@ main(int argc, char *argv[])
   printf("read\n");
 
   fd = open(path, O_RDONLY);
-  for (i = 0; i < 20; i++)
+  for (n = 0; n < 20; n++)
     read(fd, data, sizeof(data));
   close(fd);
+}
+
+void
+worker(void *arg)
+{
+  stress((int)(uint64)arg);
+  exit(0);
+}
+
+// "-t": the same work in threads of one process, made by
+// clone(), so that they run on all harts at once.
+int
+main(int argc, char *argv[])
+{
+  int i, tids[NWORKER];
+
+  printf("stressfs starting\n");
+
+  if(argc > 1 && strcmp(argv[1], "-t") == 0){
+    for(i = 0; i < NWORKER; i++){
+      char *stack = malloc(STACKSIZE);
+      if(stack == 0 || (tids[i] = clone(worker, (void*)(uint64)i, stack + STACKSIZE)) < 0){
+        printf("stressfs: clone failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < NWORKER; i++)
+      join(tids[i]);
+    exit(0);
+  }
+
+  for(i = 0; i < NWORKER - 1; i++)
+    if(fork() > 0)
+      break;
+
+  stress(i);
 
   wait(0);
 
@@ -0,0 +1,120 @@
+/*
+ * print system call counts and latencies
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- counts since boot, or "sysstat [-h] cmd args" for one command's
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+char *names[NSYSSTAT] = {
+[SYS_fork]      "fork",
+[SYS_exit]      "exit",
+[SYS_wait]      "wait",
+[SYS_pipe]      "pipe",
+[SYS_read]      "read",
+[SYS_kill]      "kill",
+[SYS_exec]      "exec",
+[SYS_fstat]     "fstat",
+[SYS_chdir]     "chdir",
+[SYS_dup]       "dup",
+[SYS_getpid]    "getpid",
+[SYS_sbrk]      "sbrk",
+[SYS_sleep]     "sleep",
+[SYS_uptime]    "uptime",
+[SYS_open]      "open",
+[SYS_write]     "write",
+[SYS_mknod]     "mknod",
+[SYS_unlink]    "unlink",
+[SYS_link]      "link",
+[SYS_mkdir]     "mkdir",
+[SYS_close]     "close",
+[SYS_getprocs]  "getprocs",
+[SYS_memtest]   "memtest",
+[SYS_setpriority] "setpriority",
+[SYS_clone]     "clone",
+[SYS_join]      "join",
+[SYS_fsync]     "fsync",
+[SYS_mmap]      "mmap",
+[SYS_munmap]    "munmap",
+[SYS_splice]    "splice",
+[SYS_readv]     "readv",
+[SYS_writev]    "writev",
+[SYS_ringenter] "ringenter",
+[SYS_lockstat]  "lockstat",
+[SYS_dstat]     "dstat",
+[SYS_profstart] "profstart",
+[SYS_profstop]  "profstop",
+[SYS_profread]  "profread",
+[SYS_tracectl]  "tracectl",
+[SYS_traceread] "traceread",
+[SYS_procstat]  "procstat",
+[SYS_sysstat]   "sysstat",
+[SYS_iostat]    "iostat",
+[SYS_spawn]     "spawn",
+[SYS_setaffinity] "setaffinity",
+};
+
+struct sysstat before[NSYSSTAT], after[NSYSSTAT];
+
+// Counters of the system calls made while running argv, by
+// taking them before and after.
+int
+run(char **argv)
+{
+  int pid;
+
+  if(sysstat(before, NSYSSTAT) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    exec(argv[0], argv);
+    fprintf(2, "sysstat: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  wait(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, hist = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-h") == 0){
+    hist = 1;
+    argv++;
+    argc--;
+  }
+  if(argc > 1 && run(argv + 1) < 0){
+    fprintf(2, "sysstat: failed\n");
+    exit(1);
+  }
+  if((n = sysstat(after, NSYSSTAT)) < 0){
+    fprintf(2, "sysstat: failed\n");
+    exit(1);
+  }
+  // latencies in microseconds, at 10 timer cycles each.
+  printf("syscall calls avg_us\n");
+  for(int i = 0; i < n; i++){
+    struct sysstat *s = &after[i];
+    s->count -= before[i].count;
+    s->time -= before[i].time;
+    if(s->count == 0)
+      continue;
+    printf("%s %l %l\n", names[i] ? names[i] : "?", s->count, s->time / s->count / 10);
+    if(!hist)
+      continue;
+    for(int b = 0; b < SYSSTAT_NBUCKET; b++)
+      if(after[i].hist[b] - before[i].hist[b])
+        printf("  < %l us: %d\n", (2L << b) / 10, after[i].hist[b] - before[i].hist[b]);
+  }
+  exit(0);
+}
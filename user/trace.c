@@ -0,0 +1,83 @@
+/*
+ * trace a command with the kernel's tracepoints
+ * update time: 2026-10-14
+ * author: feng
+ * version: 1.0
+ * update log:
+ * v1.0 -- "trace [-m mask] cmd args": records in time order, microseconds apart
+ */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define NENT (NCPU * TRACENBUF)
+
+struct traceent ents[NENT];
+
+char *names[] = {
+[TR_SYSENTER] "syscall",
+[TR_SYSEXIT]  "sysret",
+[TR_SWITCH]   "switch",
+[TR_BHIT]     "bhit",
+[TR_BMISS]    "bmiss",
+[TR_DISKSUB]  "disk",
+[TR_DISKDONE] "diskdone",
+[TR_KALLOC]   "kalloc",
+[TR_DALLOC]   "dalloc",
+[TR_LOST]     "lost",
+};
+
+int
+main(int argc, char *argv[])
+{
+  int mask = (1 << TR_NEVENT) - 1;
+  int pid, n;
+
+  if(argc > 2 && strcmp(argv[1], "-m") == 0){
+    mask = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: trace [-m mask] cmd args\n");
+    exit(1);
+  }
+
+  tracectl(mask);
+  if((pid = fork()) < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "trace: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  tracectl(0);
+  if((n = traceread(ents, NENT)) < 0){
+    fprintf(2, "trace: traceread failed\n");
+    exit(1);
+  }
+
+  // merge the CPUs' records by time.
+  for(int gap = n / 2; gap > 0; gap /= 2)
+    for(int i = gap; i < n; i++){
+      struct traceent e = ents[i];
+      int j;
+      for(j = i; j >= gap && ents[j-gap].time > e.time; j -= gap)
+        ents[j] = ents[j-gap];
+      ents[j] = e;
+    }
+
+  for(int i = 0; i < n; i++){
+    struct traceent *e = &ents[i];
+    char *name = e->event < sizeof(names)/sizeof(names[0]) && names[e->event] ? names[e->event] : "?";
+    printf("%l cpu%d pid %d %s %l %l\n", (e->time - ents[0].time) / 10,
+           e->cpu, e->pid, name, e->a, e->b);
+  }
+  exit(0);
+}
@@ -1,6 +1,10 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 //
@@ -14,6 +18,62 @@ _main()
   exit(0);
 }
 
+// Set by printf.c once it buffers output, to flush it all, and
+// to flush and forget one descriptor's buffer. Hooks rather than
+// calls, so that programs linked without printf.o (forktest)
+// stay small.
+void (*_flushall)(void);
+void (*_closed)(int);
+
+// exit(), exec() and fork() flush buffered output first, so that
+// it is neither lost nor written twice, by parent and child.
+int
+exit(int status)
+{
+  if(_flushall)
+    _flushall();
+  _exit(status);
+}
+
+int
+fork(void)
+{
+  if(_flushall)
+    _flushall();
+  return _fork();
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(_flushall)
+    _flushall();
+  return _exec(path, argv);
+}
+
+// These read what the kernel keeps for them in the vdso page
+// and in tp, without a trap; the _ versions are the system calls.
+int
+getpid(void)
+{
+  int pid;
+
+  asm volatile("mv %0, tp" : "=r" (pid));
+  return pid;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
+
+int
+getprocs(void)
+{
+  return ((volatile struct vdso*)VDSO)->nactive;
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -63,15 +123,56 @@ strchr(const char *s, char c)
   return 0;
 }
 
+// Input buffered per descriptor, for getc() and gets(), so that
+// reading a line from a file or pipe is not a read() per byte.
+// The console's read() returns at most a line anyway. Data read
+// ahead is not seen by other processes reading the descriptor.
+#define NINFD 8      // descriptors with a buffer; others have none
+#define INBUFSZ 512
+
+static struct {
+  char buf[INBUFSZ];
+  int n;             // bytes in buf
+  int pos;           // next byte to return
+} in[NINFD];
+
+// close() flushes fd's output and drops its read-ahead, which
+// belong to the file leaving the descriptor.
+int
+close(int fd)
+{
+  if(_closed)
+    _closed(fd);
+  if(fd >= 0 && fd < NINFD)
+    in[fd].n = in[fd].pos = 0;
+  return _close(fd);
+}
+
+// Return the next byte read from fd, or -1 at end of file.
+int
+getc(int fd)
+{
+  char c;
+  int n;
+
+  if(fd < 0 || fd >= NINFD)
+    return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+  if(in[fd].pos == in[fd].n){
+    if((n = read(fd, in[fd].buf, sizeof(in[fd].buf))) <= 0)
+      return -1;
+    in[fd].n = n;
+    in[fd].pos = 0;
+  }
+  return (uchar)in[fd].buf[in[fd].pos++];
+}
+
 char*
 gets(char *buf, int max)
 {
-  int i, cc;
-  char c;
+  int i, c;
 
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
+    if((c = getc(0)) < 0)
       break;
     buf[i++] = c;
     if(c == '\n' || c == '\r')
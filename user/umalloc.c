@@ -3,8 +3,14 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Small blocks come from power-of-two size classes, each a LIFO
+// free list refilled a chunk at a time, so malloc() and free()
+// of them take constant time. Larger blocks go through the
+// address-ordered first-fit list of Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7,
+// which stays short since only large blocks are ever on it.
+// A large free block that ends at the break is given back to
+// the kernel.
 
 typedef long Align;
 
@@ -18,15 +24,49 @@ union header {
 
 typedef union header Header;
 
+#define NBIN 8                        // size classes
+#define BINUNITS(k) (2 << (k))        // block size of class k, in Headers
+#define SMALLMAX BINUNITS(NBIN-1)     // largest small block, 4096 bytes
+#define CHUNK 16384                   // bytes sbrk()ed to refill a class
+#define TRIM 65536                    // smallest free tail given back
+
+static Header *bin[NBIN];
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Threads created with clone() share the allocator.
+static int lk;
+
+static void
+lock(void)
 {
-  Header *bp, *p;
+  while(__sync_lock_test_and_set(&lk, 1) != 0)
+    ;
+}
+
+static void
+unlock(void)
+{
+  __sync_lock_release(&lk);
+}
+
+static int
+binof(uint nunits)
+{
+  int k;
+
+  for(k = 0; BINUNITS(k) < nunits; k++)
+    ;
+  return k;
+}
+
+// Return a large block to the free list, merging it with its
+// neighbours. Returns the free block that now holds it.
+static Header*
+lfree(Header *bp)
+{
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -35,12 +75,68 @@ free(void *ap)
     bp->s.ptr = p->s.ptr->s.ptr;
   } else
     bp->s.ptr = p->s.ptr;
+  freep = p;
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
+    return p;
+  }
+  p->s.ptr = bp;
+  return bp;
+}
+
+// Give free block bp back to the kernel if it is large and
+// ends at the break.
+static void
+trim(Header *bp)
+{
+  Header *p;
+
+  if(bp->s.size < TRIM / sizeof(Header) || (char*)(bp + bp->s.size) != sbrk(0))
+    return;
+  for(p = freep; p->s.ptr != bp; p = p->s.ptr)
+    ;
+  p->s.ptr = bp->s.ptr;
   freep = p;
+  sbrk(-(int)(bp->s.size * sizeof(Header)));
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  int k;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  lock();
+  if(bp->s.size <= SMALLMAX){
+    k = binof(bp->s.size);
+    bp->s.ptr = bin[k];
+    bin[k] = bp;
+  } else
+    trim(lfree(bp));
+  unlock();
+}
+
+// Carve a fresh chunk into blocks of class k.
+static int
+refill(int k)
+{
+  char *p;
+  Header *hp;
+  uint n = BINUNITS(k) * sizeof(Header);
+
+  if((p = sbrk(CHUNK)) == (char*)-1)
+    return -1;
+  for(char *q = p; q + n <= p + CHUNK; q += n){
+    hp = (Header*)q;
+    hp->s.size = BINUNITS(k);
+    hp->s.ptr = bin[k];
+    bin[k] = hp;
+  }
+  return 0;
 }
 
 static Header*
@@ -49,24 +145,22 @@ morecore(uint nu)
   char *p;
   Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
+  // whole pages, so that a trimmed break stays page aligned.
+  nu = (nu + 4096/sizeof(Header) - 1) & ~(4096/sizeof(Header) - 1);
   p = sbrk(nu * sizeof(Header));
   if(p == (char*)-1)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+lmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -88,3 +182,28 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+  int k;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  lock();
+  if(nunits > SMALLMAX){
+    p = lmalloc(nunits);
+    unlock();
+    return p;
+  }
+  k = binof(nunits);
+  if(bin[k] == 0 && refill(k) < 0){
+    unlock();
+    return 0;
+  }
+  p = bin[k];
+  bin[k] = p->s.ptr;
+  unlock();
+  return (void*)(p + 1);
+}
@@ -1,8 +1,24 @@
 struct stat;
+struct iovec;
+struct ringent;
+struct lockstat;
+struct dstat;
+struct profsample;
+struct traceent;
+struct procstat;
+struct sysstat;
+struct iostat;
 
 // system calls
 int fork(void);
 int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _close(int);
+int _exec(const char*, char**);
+int _getpid(void);
+int _uptime(void);
+int _getprocs(void);
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
@@ -23,7 +39,29 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int getprocs(void);
-int memtest(void);
+int memtest(int);
+int setpriority(int, int);
+int clone(void (*)(void *), void *, void *);
+int join(int);
+int fsync(int);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int ringenter(struct ringent*, int);
+int lockstat(struct lockstat*, int);
+int dstat(struct dstat*);
+int profstart(void);
+int profstop(void);
+int profread(struct profsample*, int);
+int tracectl(int);
+int traceread(struct traceent*, int);
+int procstat(struct procstat*, int);
+int sysstat(struct sysstat*, int);
+int iostat(struct iostat*);
+int spawn(const char*, char**, int*);
+int setaffinity(int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -33,7 +71,9 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
+int getc(int);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
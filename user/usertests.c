@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/procstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -575,6 +576,10 @@ writetest(char *s)
   }
 }
 
+// MAXFILE no longer fits on the disk; go a little way into
+// the double-indirect blocks instead.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -586,7 +591,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +611,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGBLOCKS - 1){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -2571,38 +2576,731 @@ badarg(char *s)
   exit(0);
 }
 
+// check that file name holds exactly the n bytes at want.
+static void
+checkfile(char *s, char *name, char *want, int n)
+{
+  int fd, got;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("%s: open %s failed\n", s, name);
+    exit(1);
+  }
+  got = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(got != n || memcmp(buf, want, n) != 0){
+    printf("%s: %s holds %d bytes, wanted %d\n", s, name, got, n);
+    exit(1);
+  }
+}
+
+// a file of at most NINLINE bytes keeps its data in the inode.
+// grow one across NINLINE, truncate it, splice into and out of
+// it, and check that a write that fails after moving the data
+// to a block leaves the file inline and unchanged.
+void
+inlinefile(char *s)
+{
+  char data[3*NINLINE], got[NINLINE];
+  char *top;
+  int fd, n, p[2];
+  struct stat st;
+
+  for(int i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + i % 26;
+  unlink("inl");
+  if((fd = open("inl", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, data, NINLINE - 2) != NINLINE - 2 ||
+     write(fd, data + NINLINE - 2, 2*NINLINE + 2) != 2*NINLINE + 2){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  checkfile(s, "inl", data, 3*NINLINE);
+
+  // back to inline data after O_TRUNC.
+  fd = open("inl", O_RDWR|O_TRUNC);
+  if(write(fd, data, 10) != 10){
+    printf("%s: write after truncate failed\n", s);
+    exit(1);
+  }
+  checkfile(s, "inl", data, 10);
+
+  // the source runs off the end of memory, so none of it is copied.
+  top = sbrk(0);
+  top[-1] = 0;
+  if(write(fd, top - 8, NINLINE * 2) == NINLINE * 2){
+    printf("%s: write from a bad buffer succeeded\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != 10){
+    printf("%s: size %d after a failed write, wanted 10\n", s, (int)st.size);
+    exit(1);
+  }
+  checkfile(s, "inl", data, 10);
+  close(fd);
+
+  // splice into an inline file, then across NINLINE.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("inl", O_RDWR|O_TRUNC);
+  write(p[1], data, 20);
+  if((n = splice(p[0], fd, 20)) != 20){
+    printf("%s: splice into file moved %d, wanted 20\n", s, n);
+    exit(1);
+  }
+  write(p[1], data + 20, 2*NINLINE);
+  if((n = splice(p[0], fd, 2*NINLINE)) != 2*NINLINE){
+    printf("%s: splice across NINLINE moved %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  checkfile(s, "inl", data, 2*NINLINE + 20);
+
+  // and out of an inline one.
+  fd = open("inl", O_RDWR|O_TRUNC);
+  write(fd, data, 30);
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  if((n = splice(fd, p[1], NINLINE)) != 30){
+    printf("%s: splice out of file moved %d, wanted 30\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  if(read(p[0], got, sizeof(got)) != 30 || memcmp(got, data, 30) != 0){
+    printf("%s: splice out of file: wrong data\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+  unlink("inl");
+}
+
+// mmap() a file: a private mapping reads its data and zeros past
+// its end, and keeps its stores to itself; a shared one writes
+// its stores back at munmap() and shares the pages it touched
+// with a child of fork(). Also the calls it must refuse.
+void
+mmaptest(char *s)
+{
+  char *data, *p;
+  int fd, pid, xstatus;
+
+  data = malloc(2*PGSIZE);
+  for(int i = 0; i < 2*PGSIZE; i++)
+    data[i] = 'a' + i % 23;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(memcmp(p, data, 2*PGSIZE) != 0 || p[2*PGSIZE] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: private mapping has the wrong data\n", s);
+    exit(1);
+  }
+  p[0] = 'Q';
+  // a hole in the middle, past the end, not page-aligned.
+  if(munmap(p + PGSIZE, PGSIZE) == 0 || munmap(p, 4*PGSIZE) == 0 ||
+     munmap(p + 1, PGSIZE) == 0 || munmap(p + 3*PGSIZE, PGSIZE) == 0){
+    printf("%s: bad munmap succeeded\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    xstatus = p[0];
+    exit(xstatus);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: unmapped memory readable\n", s);
+    exit(1);
+  }
+  checkfile(s, "mmapfile", data, 2*PGSIZE);
+
+  // stores to a shared mapping reach the file.
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, PGSIZE);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[0] = 'X';
+  p[PGSIZE-1] = 'Y';
+  munmap(p, PGSIZE);
+  data[PGSIZE] = 'X';
+  data[2*PGSIZE-1] = 'Y';
+  checkfile(s, "mmapfile", data, 2*PGSIZE);
+
+  // a child of fork() shares the pages touched before it.
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1 || p[0] != data[0]){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    p[1] = 'Z';
+    exit(0);
+  }
+  wait(0);
+  if(p[1] != 'Z'){
+    printf("%s: child's store not seen\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+
+  // bad descriptor, length, offset, flags; write access to a
+  // file open only for reading.
+  fd = open("mmapfile", O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, 99, 0) != (char*)-1 ||
+     mmap(0, 0, PROT_READ, MAP_PRIVATE, fd, 0) != (char*)-1 ||
+     mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 1) != (char*)-1 ||
+     mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0x80000000) != (char*)-1 ||
+     mmap(0, PGSIZE, PROT_READ, 0, fd, 0) != (char*)-1 ||
+     mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: bad mmap succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  free(data);
+  unlink("mmapfile");
+}
+
+// copy a file to another through a pipe with splice(), and the
+// splices it must refuse.
+void
+splicetest(char *s)
+{
+  enum { N = 3*BSIZE + 100 };
+  char *data;
+  int in, out, p[2], q[2], n, tot;
+
+  data = malloc(N);
+  for(int i = 0; i < N; i++)
+    data[i] = 'a' + i % 19;
+  unlink("splicein");
+  unlink("spliceout");
+  in = open("splicein", O_CREATE|O_RDWR);
+  if(in < 0 || write(in, data, N) != N){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(in);
+  in = open("splicein", O_RDONLY);
+  out = open("spliceout", O_CREATE|O_WRONLY);
+  if(pipe(p) < 0 || pipe(q) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // at most a few hundred bytes at a time, which the pipe holds.
+  for(tot = 0; (n = splice(in, p[1], 300)) > 0; tot += n){
+    if(splice(p[0], out, n) != n){
+      printf("%s: splice into file failed\n", s);
+      exit(1);
+    }
+  }
+  if(n < 0 || tot != N){
+    printf("%s: splice out of file moved %d, wanted %d\n", s, tot, N);
+    exit(1);
+  }
+  close(out);
+  checkfile(s, "spliceout", data, N);
+
+  // neither end a pipe, both pipes, a bad descriptor, a
+  // negative length, a file open only for writing.
+  out = open("spliceout", O_WRONLY);
+  if(splice(in, out, 10) >= 0 || splice(p[0], q[1], 10) >= 0 ||
+     splice(99, p[1], 10) >= 0 || splice(in, p[1], -1) >= 0 ||
+     splice(out, p[1], 10) >= 0){
+    printf("%s: bad splice succeeded\n", s);
+    exit(1);
+  }
+  // the end of a pipe whose write end is closed.
+  close(p[1]);
+  if(splice(p[0], out, 10) != 0){
+    printf("%s: splice at end of pipe did not return 0\n", s);
+    exit(1);
+  }
+  // a pipe whose read end is closed.
+  close(q[0]);
+  close(in);
+  in = open("splicein", O_RDONLY);
+  if(splice(in, q[1], 10) >= 0){
+    printf("%s: splice into a pipe without a reader succeeded\n", s);
+    exit(1);
+  }
+  close(in);
+  close(out);
+  close(p[0]);
+  close(q[1]);
+  free(data);
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// writev() and readv() to a file and a pipe, split differently
+// on each side, a readv() that the file fills only in part, and
+// the calls they must refuse.
+void
+rwvtest(char *s)
+{
+  char want[60], got[100];
+  struct iovec iov[IOV_MAX+1];
+  int fd, n, p[2];
+
+  for(int i = 0; i < sizeof(want); i++)
+    want[i] = 'a' + i % 26;
+  for(int i = 0; i < IOV_MAX+1; i++){
+    iov[i].iov_base = got;
+    iov[i].iov_len = 1;
+  }
+  unlink("rwvfile");
+  fd = open("rwvfile", O_CREATE|O_RDWR);
+  iov[0].iov_base = want;
+  iov[0].iov_len = 10;
+  iov[1].iov_base = want + 10;
+  iov[1].iov_len = 20;
+  iov[2].iov_base = want + 30;
+  iov[2].iov_len = 30;
+  if((n = writev(fd, iov, 3)) != 60){
+    printf("%s: writev wrote %d, wanted 60\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  checkfile(s, "rwvfile", want, 60);
+
+  // the second buffer is filled only in part.
+  fd = open("rwvfile", O_RDONLY);
+  memset(got, 0, sizeof(got));
+  iov[0].iov_base = got;
+  iov[0].iov_len = 25;
+  iov[1].iov_base = got + 25;
+  iov[1].iov_len = 75;
+  if((n = readv(fd, iov, 2)) != 60 || memcmp(got, want, 60) != 0){
+    printf("%s: readv read %d, wanted 60\n", s, n);
+    exit(1);
+  }
+  close(fd);
+
+  // a bad buffer after a good one ends the read there.
+  fd = open("rwvfile", O_RDONLY);
+  iov[0].iov_len = 10;
+  iov[1].iov_base = (void*)0xffffffffffffff00;
+  iov[1].iov_len = 10;
+  if((n = readv(fd, iov, 2)) != 10){
+    printf("%s: readv with a bad second buffer read %d, wanted 10\n", s, n);
+    exit(1);
+  }
+  close(fd);
+
+  // through a pipe.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = want;
+  iov[0].iov_len = 7;
+  iov[1].iov_base = want + 7;
+  iov[1].iov_len = 13;
+  if(writev(p[1], iov, 2) != 20){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = got;
+  iov[0].iov_len = 15;
+  iov[1].iov_base = got + 15;
+  iov[1].iov_len = 5;
+  if(readv(p[0], iov, 2) != 20 || memcmp(got, want, 20) != 0){
+    printf("%s: readv from pipe failed\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+
+  // a bad descriptor, count, length, iovec array or buffer.
+  fd = open("rwvfile", O_RDWR);
+  iov[0].iov_base = got;
+  iov[0].iov_len = 10;
+  iov[1].iov_base = got;
+  iov[1].iov_len = 0x80000000;
+  if(readv(99, iov, 1) >= 0 || writev(99, iov, 1) >= 0 ||
+     readv(fd, iov, -1) >= 0 || readv(fd, iov, IOV_MAX+1) >= 0 ||
+     writev(fd, iov, 2) >= 0 || readv(fd, (struct iovec*)0xffffffffffffff00, 1) >= 0){
+    printf("%s: bad readv or writev succeeded\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = (void*)0xffffffffffffff00;
+  if(writev(fd, iov, 1) >= 0){
+    printf("%s: writev from a bad buffer succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("rwvfile");
+}
+
+// open, write, read and close a file with ringenter() batches,
+// in which a failed entry does not stop the rest, and the
+// batches it must refuse.
+void
+ringtest(char *s)
+{
+  struct ringent e[4];
+  char got[16];
+  int fd;
+
+  unlink("ringfile");
+  e[0] = (struct ringent){ RING_OPEN, O_CREATE|O_RDWR, (uint64)"ringfile", 0, 0 };
+  if(ringenter(e, 1) != 1 || (fd = e[0].res) < 0){
+    printf("%s: ring open failed\n", s);
+    exit(1);
+  }
+  // a bad descriptor and an unknown operation in the middle.
+  e[0] = (struct ringent){ RING_WRITE, fd, (uint64)"ring write", 10, 0 };
+  e[1] = (struct ringent){ RING_WRITE, 99, (uint64)"x", 1, 0 };
+  e[2] = (struct ringent){ 99, fd, 0, 0, 0 };
+  e[3] = (struct ringent){ RING_CLOSE, fd, 0, 0, 0 };
+  if(ringenter(e, 4) != 4 || e[0].res != 10 || e[1].res != -1 ||
+     e[2].res != -1 || e[3].res != 0){
+    printf("%s: ring write batch: results %d %d %d %d\n", s,
+           e[0].res, e[1].res, e[2].res, e[3].res);
+    exit(1);
+  }
+  checkfile(s, "ringfile", "ring write", 10);
+
+  e[0] = (struct ringent){ RING_OPEN, O_RDONLY, (uint64)"ringfile", 0, 0 };
+  if(ringenter(e, 1) != 1 || (fd = e[0].res) < 0){
+    printf("%s: ring open failed\n", s);
+    exit(1);
+  }
+  e[0] = (struct ringent){ RING_READ, fd, (uint64)got, sizeof(got), 0 };
+  e[1] = (struct ringent){ RING_READ, fd, 0xffffffffffffff00, sizeof(got), 0 };
+  e[2] = (struct ringent){ RING_CLOSE, fd, 0, 0, 0 };
+  e[3] = (struct ringent){ RING_READ, fd, (uint64)got, sizeof(got), 0 };
+  if(ringenter(e, 4) != 4 || e[0].res != 10 || memcmp(got, "ring write", 10) != 0 ||
+     e[2].res != 0 || e[3].res != -1){
+    printf("%s: ring read batch: results %d %d %d %d\n", s,
+           e[0].res, e[1].res, e[2].res, e[3].res);
+    exit(1);
+  }
+
+  // bad counts and a bad array; an empty batch is fine.
+  if(ringenter(e, -1) != -1 || ringenter(e, RING_MAX+1) != -1 ||
+     ringenter((struct ringent*)0xffffffffffffff00, 1) != -1 ||
+     ringenter(e, 0) != 0){
+    printf("%s: bad ringenter succeeded\n", s);
+    exit(1);
+  }
+  unlink("ringfile");
+}
+
+// spawn() echo with its output into a pipe, check the name of a
+// spawned cat by procstat(), and the spawns it must refuse. The
+// programs are in the top directory.
+void
+spawntest(char *s)
+{
+  char *argv[] = { "echo", "spawned", 0 };
+  char *cargv[] = { "cat", 0 };
+  char got[32];
+  struct procstat *st;
+  int p[2], fd[3], pid, n, tot, xstatus, found = 0;
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd[0] = -1;
+  fd[1] = p[1];
+  fd[2] = 2;
+  if((pid = spawn("echo", argv, fd)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  for(tot = 0; tot < sizeof(got) && (n = read(p[0], got + tot, sizeof(got) - tot)) > 0; tot += n)
+    ;
+  close(p[0]);
+  if(tot != 8 || memcmp(got, "spawned\n", 8) != 0){
+    printf("%s: child wrote %d bytes, wanted \"spawned\"\n", s, tot);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: child did not exit 0\n", s);
+    exit(1);
+  }
+
+  // the child is named after its program, not its parent.
+  st = malloc(NPROC * sizeof(*st));
+  pipe(p);
+  fd[0] = p[0];
+  fd[1] = -1;
+  if((pid = spawn("cat", cargv, fd)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  n = procstat(st, NPROC);
+  for(int i = 0; i < n; i++)
+    if(st[i].pid == pid)
+      found = strcmp(st[i].name, "cat") == 0 ? 1 : -1;
+  close(p[0]);
+  close(p[1]);
+  wait(0);
+  free(st);
+  if(found != 1){
+    printf("%s: spawned child not named cat\n", s);
+    exit(1);
+  }
+
+  // no such program, a closed or bad descriptor, bad argv or
+  // descriptor array.
+  fd[1] = 1;
+  if(spawn("nosuchprog", argv, fd) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  fd[1] = 99;
+  if(spawn("echo", argv, fd) >= 0){
+    printf("%s: spawn with a closed descriptor succeeded\n", s);
+    exit(1);
+  }
+  fd[1] = -2;
+  if(spawn("echo", argv, fd) >= 0){
+    printf("%s: spawn with a bad descriptor succeeded\n", s);
+    exit(1);
+  }
+  fd[1] = 1;
+  if(spawn("echo", (char**)0xffffffffffffff00, fd) >= 0 ||
+     spawn("echo", argv, (int*)0xffffffffffffff00) >= 0){
+    printf("%s: spawn with a bad array succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: a refused spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// threads made by clone() in threadtest and threadsbrk.
+#define TSTACK 4096
+static volatile int tgo;      // threads may exit
+static volatile int tcount;   // threads started
+static volatile int tfork;    // what fork() returned in a thread
+static char *volatile tmem;   // memory grown by sbrk()
+
+static void
+tcounter(void *arg)
+{
+  __sync_fetch_and_add(&tcount, 1);
+  while(tgo == 0)
+    ;
+  exit(0);
+}
+
+static void
+tforker(void *arg)
+{
+  int pid;
+
+  if((pid = fork()) == 0)
+    exit(0);
+  if(pid > 0)
+    wait(0);
+  tfork = pid;
+  exit(0);
+}
+
+// start threads that share memory, join them, and check what a
+// process may not do while its page table is shared: shrink its
+// memory, fork(), mmap(); nor clone() while it has mappings.
+void
+threadtest(char *s)
+{
+  enum { N = 4 };
+  int tids[N], fd, pid;
+  char *stacks, *p;
+
+  stacks = sbrk(N*TSTACK);
+  tcount = 0;
+  tgo = 0;
+  for(int i = 0; i < N; i++){
+    if((tids[i] = clone(tcounter, 0, stacks + (i+1)*TSTACK)) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  while(tcount < N)
+    ;
+
+  if(sbrk(-PGSIZE) != (char*)-1){
+    printf("%s: sbrk shrank shared memory\n", s);
+    exit(1);
+  }
+  if((pid = fork()) == 0)
+    exit(0);
+  if(pid > 0){
+    wait(0);
+    printf("%s: fork with threads succeeded\n", s);
+    exit(1);
+  }
+  unlink("thrfile");
+  fd = open("thrfile", O_CREATE|O_RDWR);
+  write(fd, buf, PGSIZE);
+  if(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0) != (char*)-1){
+    printf("%s: mmap with threads succeeded\n", s);
+    exit(1);
+  }
+  tgo = 1;
+  for(int i = 0; i < N; i++){
+    if(join(tids[i]) != tids[i]){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(join(tids[0]) != -1 || join(getpid()) != -1 || join(0) != -1){
+    printf("%s: bad join succeeded\n", s);
+    exit(1);
+  }
+
+  // a thread's fork() fails too.
+  tfork = 0;
+  if((pid = clone(tforker, 0, stacks + TSTACK)) < 0 || join(pid) != pid){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if(tfork >= 0){
+    printf("%s: fork in a thread succeeded\n", s);
+    exit(1);
+  }
+
+  // no threads with mapped files.
+  if((p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0)) == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if((pid = clone(tcounter, 0, stacks + TSTACK)) >= 0){
+    join(pid);
+    printf("%s: clone with a mapping succeeded\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+  unlink("thrfile");
+
+  // memory is no longer shared.
+  if(sbrk(-N*TSTACK) == (char*)-1){
+    printf("%s: sbrk could not shrink after join\n", s);
+    exit(1);
+  }
+}
+
+static void
+tgrower(void *arg)
+{
+  char *p;
+
+  if((p = sbrk(PGSIZE)) != (char*)-1)
+    p[0] = 'T';
+  tmem = p;
+  exit(0);
+}
+
+static void
+tstorer(void *arg)
+{
+  while(tmem == 0)
+    ;
+  tmem[1] = 'M';
+  exit(0);
+}
+
+// memory that one thread adds with sbrk() is there for the others.
+void
+threadsbrk(char *s)
+{
+  char *stack, *p;
+  int pid;
+
+  stack = sbrk(TSTACK);
+  tmem = 0;
+  if((pid = clone(tgrower, 0, stack + TSTACK)) < 0 || join(pid) != pid){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if(tmem == (char*)-1 || tmem[0] != 'T'){
+    printf("%s: thread's sbrk not seen\n", s);
+    exit(1);
+  }
+
+  tmem = 0;
+  if((pid = clone(tstorer, 0, stack + TSTACK)) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if((p = sbrk(PGSIZE)) == (char*)-1){
+    printf("%s: sbrk with threads failed\n", s);
+    exit(1);
+  }
+  tmem = p;
+  if(join(pid) != pid || p[1] != 'M'){
+    printf("%s: thread did not see sbrk\n", s);
+    exit(1);
+  }
+}
+
+// tests that use the top directory or a machine-wide resource
+// (all of memory, the process table, the disk) are not run
+// concurrently with others by -j.
+#define ALONE 1
+
 struct test {
   void (*f)(char *);
   char *s;
+  int flags;
 } quicktests[] = {
   {copyin, "copyin"},
   {copyout, "copyout"},
   {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
+  {copyinstr2, "copyinstr2", ALONE},
   {copyinstr3, "copyinstr3"},
   {rwsbrk, "rwsbrk" },
   {truncate1, "truncate1"},
   {truncate2, "truncate2"},
   {truncate3, "truncate3"},
   {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
+  {exitiputtest, "exitiput", ALONE},
+  {iputtest, "iput", ALONE},
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
-  {exectest, "exectest"},
+  {exectest, "exectest", ALONE},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
   {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
+  {forkfork, "forkfork", ALONE},
+  {forkforkfork, "forkforkfork", ALONE},
+  {reparent2, "reparent2", ALONE},
+  {mem, "mem", ALONE},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
@@ -2610,23 +3308,23 @@ struct test {
   {linktest, "linktest"},
   {concreate, "concreate"},
   {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
+  {subdir, "subdir", ALONE},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
   {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
+  {rmdot, "rmdot", ALONE},
   {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
+  {iref, "iref", ALONE},
+  {forktest, "forktest", ALONE},
   {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
+  {sbrkmuch, "sbrkmuch", ALONE},
+  {kernmem, "kernmem", ALONE},
   {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
+  {sbrkfail, "sbrkfail", ALONE},
   {sbrkarg, "sbrkarg"},
   {validatetest, "validatetest"},
   {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
+  {bigargtest, "bigargtest", ALONE},
   {argptest, "argptest"},
   {stacktest, "stacktest"},
   {textwrite, "textwrite"},
@@ -2634,7 +3332,15 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
-  {badarg, "badarg" },
+  {badarg, "badarg", ALONE},
+  {inlinefile, "inlinefile"},
+  {mmaptest, "mmaptest"},
+  {splicetest, "splicetest"},
+  {rwvtest, "rwvtest"},
+  {ringtest, "ringtest"},
+  {spawntest, "spawntest", ALONE},
+  {threadtest, "threadtest"},
+  {threadsbrk, "threadsbrk"},
 
   { 0, 0},
 };
@@ -2927,10 +3633,10 @@ outofinodes(char *s)
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
-  {badwrite, "badwrite" },
-  {execout, "execout"},
-  {diskfull, "diskfull"},
-  {outofinodes, "outofinodes"},
+  {badwrite, "badwrite", ALONE},
+  {execout, "execout", ALONE},
+  {diskfull, "diskfull", ALONE},
+  {outofinodes, "outofinodes", ALONE},
     
   { 0, 0},
 };
@@ -2939,14 +3645,54 @@ struct test slowtests[] = {
 // drive tests
 //
 
+// outcome and wall time, in uptime() ticks, of each test run,
+// for the summary.
+#define NRESULT 128
+struct result {
+  char *s;
+  int ok;
+  int ticks;
+} results[NRESULT];
+int nresult;
+int njobs;      // -j: tests run at once, 0 to run them one by one
+int summary;    // -t or -j: print the summary
+
+void
+record(char *s, int ok, int ticks)
+{
+  if(nresult < NRESULT){
+    results[nresult].s = s;
+    results[nresult].ok = ok;
+    results[nresult].ticks = ticks;
+    nresult++;
+  }
+}
+
+// one "result" line per test and a "total" line, which can be
+// grepped out and diffed between kernels.
+void
+printsummary(int ticks)
+{
+  int failed = 0;
+
+  for(int i = 0; i < nresult; i++){
+    printf("result %s %s %d\n", results[i].s, results[i].ok ? "ok" : "fail",
+           results[i].ticks);
+    failed += !results[i].ok;
+  }
+  printf("total %d %d %d jobs %d\n", nresult, failed, ticks, njobs ? njobs : 1);
+}
+
 // run each test in its own process. run returns 1 if child's exit()
 // indicates success.
 int
 run(void f(char *), char *s) {
   int pid;
   int xstatus;
+  int start;
 
   printf("test %s: ", s);
+  start = uptime();
   if((pid = fork()) < 0) {
     printf("runtest: fork error\n");
     exit(1);
@@ -2956,6 +3702,7 @@ run(void f(char *), char *s) {
     exit(0);
   } else {
     wait(&xstatus);
+    record(s, xstatus == 0, uptime() - start);
     if(xstatus != 0) 
       printf("FAILED\n");
     else
@@ -2964,8 +3711,100 @@ run(void f(char *), char *s) {
   }
 }
 
+#define MAXJOBS 16
+
+struct job {
+  int pid;
+  struct test *t;
+  char dir[8];
+  int start;
+} jobs[MAXJOBS];
+int nrunning;
+
+// wait for one running test to finish. returns 1 if it passed.
+int
+reap(void)
+{
+  int pid, xstatus, i;
+
+  if((pid = wait(&xstatus)) < 0){
+    printf("runpar: wait error\n");
+    exit(1);
+  }
+  for(i = 0; i < nrunning && jobs[i].pid != pid; i++)
+    ;
+  if(i == nrunning)
+    return 1;   // not one of ours
+  record(jobs[i].t->s, xstatus == 0, uptime() - jobs[i].start);
+  printf("test %s: %s\n", jobs[i].t->s, xstatus == 0 ? "OK" : "FAILED");
+  if(jobs[i].dir[0])
+    unlink(jobs[i].dir);
+  jobs[i] = jobs[--nrunning];
+  return xstatus == 0;
+}
+
+// start test t, the n'th, in a directory of its own unless it
+// must run alone.
+void
+launch(struct test *t, int n)
+{
+  struct job *j = &jobs[nrunning++];
+
+  j->t = t;
+  j->dir[0] = 0;
+  if(!(t->flags & ALONE)){
+    j->dir[0] = 'u';
+    j->dir[1] = 't';
+    j->dir[2] = '0' + n / 100 % 10;
+    j->dir[3] = '0' + n / 10 % 10;
+    j->dir[4] = '0' + n % 10;
+    j->dir[5] = 0;
+  }
+  j->start = uptime();
+  if((j->pid = fork()) < 0){
+    printf("runpar: fork error\n");
+    exit(1);
+  }
+  if(j->pid == 0){
+    if(j->dir[0])
+      mkdir(j->dir);   // may be left over from an earlier run
+    if(j->dir[0] && chdir(j->dir) < 0){
+      printf("%s: cannot make %s\n", t->s, j->dir);
+      exit(1);
+    }
+    t->f(t->s);
+    exit(0);
+  }
+}
+
+// run up to njobs tests at once. an ALONE test waits for the
+// others to finish and runs by itself. unlike the sequential
+// runtests(), goes on past a failure.
+int
+runpar(struct test *tests, char *justone) {
+  int ok = 1;
+  int n = 0;
+
+  for (struct test *t = tests; t->s != 0; t++, n++) {
+    if((justone != 0) && strcmp(t->s, justone) != 0)
+      continue;
+    while(nrunning > ((t->flags & ALONE) ? 0 : njobs - 1))
+      ok &= reap();
+    launch(t, n);
+    if(t->flags & ALONE)
+      ok &= reap();
+  }
+  while(nrunning > 0)
+    ok &= reap();
+  if(!ok)
+    printf("SOME TESTS FAILED\n");
+  return !ok;
+}
+
 int
 runtests(struct test *tests, char *justone) {
+  if(njobs > 0)
+    return runpar(tests, justone);
   for (struct test *t = tests; t->s != 0; t++) {
     if((justone == 0) || strcmp(t->s, justone) == 0) {
       if(!run(t->f, t->s)){
@@ -3050,8 +3889,12 @@ drivetests(int quick, int continuous, char *justone) {
     printf("usertests starting\n");
     int free0 = countfree();
     int free1 = 0;
+    int start = uptime();
+    nresult = 0;
     if (runtests(quicktests, justone)) {
       if(continuous != 2) {
+        if(summary)
+          printsummary(uptime() - start);
         return 1;
       }
     }
@@ -3060,10 +3903,14 @@ drivetests(int quick, int continuous, char *justone) {
         printf("usertests slow tests starting\n");
       if (runtests(slowtests, justone)) {
         if(continuous != 2) {
+          if(summary)
+            printsummary(uptime() - start);
           return 1;
         }
       }
     }
+    if(summary)
+      printsummary(uptime() - start);
     if((free1 = countfree()) < free0) {
       printf("FAILED -- lost some free pages %d (out of %d)\n", free1, free0);
       if(continuous != 2) {
@@ -3081,17 +3928,25 @@ main(int argc, char *argv[])
   int quick = 0;
   char *justone = 0;
 
-  if(argc == 2 && strcmp(argv[1], "-q") == 0){
-    quick = 1;
-  } else if(argc == 2 && strcmp(argv[1], "-c") == 0){
-    continuous = 1;
-  } else if(argc == 2 && strcmp(argv[1], "-C") == 0){
-    continuous = 2;
-  } else if(argc == 2 && argv[1][0] != '-'){
-    justone = argv[1];
-  } else if(argc > 1){
-    printf("Usage: usertests [-c] [-C] [-q] [testname]\n");
-    exit(1);
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-q") == 0){
+      quick = 1;
+    } else if(strcmp(argv[i], "-c") == 0){
+      continuous = 1;
+    } else if(strcmp(argv[i], "-C") == 0){
+      continuous = 2;
+    } else if(strcmp(argv[i], "-t") == 0){
+      summary = 1;
+    } else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc &&
+              (njobs = atoi(argv[i+1])) > 0 && njobs <= MAXJOBS){
+      summary = 1;
+      i++;
+    } else if(argv[i][0] != '-' && justone == 0){
+      justone = argv[i];
+    } else {
+      printf("Usage: usertests [-c] [-C] [-q] [-t] [-j N] [testname]\n");
+      exit(1);
+    }
   }
   if (drivetests(quick, continuous, justone)) {
     exit(1);
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("name", "sym") names the stub sym, for a system call
+# that ulib.c wraps under its own name.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -32,9 +35,31 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
+entry("getpid", "_getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
-entry("getprocs");
-entry("memtest");
\ No newline at end of file
+entry("uptime", "_uptime");
+entry("getprocs", "_getprocs");
+entry("memtest");
+entry("setpriority");
+entry("clone");
+entry("join");
+entry("fsync");
+entry("mmap");
+entry("munmap");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("ringenter");
+entry("lockstat");
+entry("dstat");
+entry("profstart");
+entry("profstop");
+entry("profread");
+entry("tracectl");
+entry("traceread");
+entry("procstat");
+entry("sysstat");
+entry("iostat");
+entry("spawn");
+entry("setaffinity");